@@ -0,0 +1,85 @@
+#include "client.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+int fsd_connect(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Socket path too long.\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int fsd_read_full(int fd, void *buf, size_t len) {
+    uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int fsd_call(int fd, uint16_t op, int32_t arg0, int32_t arg1,
+             const void *payload, uint32_t len,
+             void *reply, uint32_t cap, uint32_t *reply_len) {
+    FsdRequest req = { len, op, 0, arg0, arg1 };
+
+    // Header and payload leave in one system call; a closed daemon is
+    // reported as FSD_DISCONNECTED rather than raising SIGPIPE
+    struct iovec iov[2] = {
+        { &req, sizeof(req) },
+        { (void *)payload, len },
+    };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len > 0 ? 2 : 1;
+    int iovcnt = msg.msg_iovlen;
+    size_t left = sizeof(req) + len;
+    while (left > 0) {
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return FSD_DISCONNECTED;
+        left -= n;
+        // Partial write: advance past what was sent
+        for (int i = 0; i < iovcnt && n > 0; i++) {
+            size_t step = (size_t)n < iov[i].iov_len ? (size_t)n : iov[i].iov_len;
+            iov[i].iov_base = (uint8_t *)iov[i].iov_base + step;
+            iov[i].iov_len -= step;
+            n -= step;
+        }
+    }
+
+    FsdResponse resp;
+    if (fsd_read_full(fd, &resp, sizeof(resp)) == -1) return FSD_DISCONNECTED;
+    uint32_t keep = resp.len < cap ? resp.len : cap;
+    if (keep > 0 && fsd_read_full(fd, reply, keep) == -1) return FSD_DISCONNECTED;
+    // Drain whatever did not fit
+    uint8_t scratch[4096];
+    for (uint32_t rest = resp.len - keep; rest > 0; ) {
+        uint32_t n = rest < sizeof(scratch) ? rest : sizeof(scratch);
+        if (fsd_read_full(fd, scratch, n) == -1) return FSD_DISCONNECTED;
+        rest -= n;
+    }
+    if (reply_len) *reply_len = keep;
+    return resp.status;
+}
@@ -0,0 +1,20 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <stdint.h>
+#include "proto.h"
+
+#define FSD_DISCONNECTED (-2) // fsd_call status when the transport fails
+
+// --- FUNCTION DECLARATIONS ---
+
+int fsd_connect(const char *path); // Returns the socket fd or -1
+
+// Sends one request and waits for its reply. Up to cap bytes of the reply
+// payload are stored in reply (the rest is discarded) and the stored length
+// in *reply_len when it is not NULL. Returns the reply status.
+int fsd_call(int fd, uint16_t op, int32_t arg0, int32_t arg1,
+             const void *payload, uint32_t len,
+             void *reply, uint32_t cap, uint32_t *reply_len);
+
+#endif
@@ -1,71 +1,112 @@
 #include "fs.h"
+#include "io.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
-FILE *disk = NULL;
 SuperBlock sb;
-
-// Bitmap Cache (4096 bytes covers 32768 blocks)
-uint8_t bitmap[BLOCK_SIZE];
+int io_mode = IO_STDIO; // Backend used by fs_open_disk
+int64_t format_blocks = DEFAULT_TOTAL_BLOCKS; // Image size used by the next format
+
+// Bitmap Cache (sb.bitmap_blocks blocks, one bit per block of the image)
+uint8_t *bitmap = NULL;
+int64_t alloc_hint = 0; // Bitmap byte where the next free-block search starts
+
+// Deduplication State (rebuilt from the file list at mount)
+// One entry per data block in use; metadata blocks have none
+DedupEntry *dedup_blocks = NULL; // By address
+DedupLink *dedup_links = NULL;   // By fingerprint
+int64_t dedup_slots = 0;         // Slots in each table, a power of two
+int64_t dedup_count = 0;         // Blocks indexed
+int64_t dedup_hits = 0;
+int64_t dedup_lookups = 0;
 
 FileEntry current_file;
-int32_t current_file_pos = -1;
+int64_t current_file_pos = -1;
 
 // Global Context
 int32_t current_uid = 0;
 int32_t current_gid = 0;
 int32_t current_user_groups[MAX_USER_GROUPS];
+int64_t rm_epoch = 0; // Bumped by fs_rm so saved sessions can spot stale files
 
 // Helper Prototypes
-int32_t alloc_block(); // No size argument needed anymore (always 1 block)
-void free_block(int32_t addr);
+int64_t alloc_block(); // No size argument needed anymore (always 1 block)
+void free_block(int64_t addr);
 int fs_check_permission(FileEntry *fe, int mode);
-int32_t find_user_by_name(const char* name, User* out_user);
-int32_t find_group_by_name(const char* name, Group* out_group);
+int64_t find_user_by_name(const char* name, User* out_user);
+int64_t find_group_by_name(const char* name, Group* out_group);
 void reload_current_user_groups();
 void fs_create_root_user();
 void fs_save_bitmap();
+void fs_save_bitmap_block(int64_t blk);
+int fs_load_data(FileEntry *fe, uint8_t *buf);
+int fs_store_block(FileEntry *fe, const uint8_t *data, int len);
+void dedup_reset();
+void dedup_rebuild();
+DedupEntry *dedup_block(int64_t addr);
+uint32_t dedup_refs(int64_t addr);
+void dedup_insert(int64_t addr, uint64_t fp, int32_t len);
+void dedup_remove(int64_t addr);
+int64_t dedup_lookup(uint64_t fp, const uint8_t *data, int len);
+int fsck_valid_addr(int64_t addr);
+int64_t bt_lookup(const char *key);
+int bt_insert(const char *key, int64_t val);
+void bt_delete(const char *key);
+void bt_rebuild();
+int fs_write_compressed(int pos, int n_bytes, const char *buffer);
 
 // --- MEMORY MANAGEMENT (BITMAP) ---
 
 void fs_save_superblock() {
-    fseek(disk, 0, SEEK_SET);
-    fwrite(&sb, sizeof(SuperBlock), 1, disk);
-    fflush(disk);
+    io_write(&sb, sizeof(SuperBlock), 0);
+    io_sync();
 }
 
 void fs_save_bitmap() {
-    // Bitmap is stored in Block 1 (offset 4096)
-    fseek(disk, BLOCK_SIZE, SEEK_SET);
-    fwrite(bitmap, BLOCK_SIZE, 1, disk);
+    // Bitmap region starts at sb.bitmap_start (Block 1 on a fresh image)
+    io_batch_begin();
+    for (int64_t i = 0; i < sb.bitmap_blocks; i++) {
+        io_write(bitmap + i * BLOCK_SIZE, BLOCK_SIZE, BLOCK_OFF(sb.bitmap_start + i));
+    }
+    io_batch_end();
+}
+
+// Writes back only the bitmap block that holds blk's bit
+void fs_save_bitmap_block(int64_t blk) {
+    int64_t i = blk / BITS_PER_BITMAP_BLOCK;
+    io_write(bitmap + i * BLOCK_SIZE, BLOCK_SIZE, BLOCK_OFF(sb.bitmap_start + i));
 }
 
-// Allocates ONE 4KB block using Bitmask
-// Returns physical address on disk
-int32_t alloc_block() {
-    for (int i = 0; i < BLOCK_SIZE; i++) {
+// Allocates ONE 4KB block using Bitmask (next fit from alloc_hint)
+// Returns the block number
+int64_t alloc_block() {
+    int64_t nbytes = (sb.total_blocks + 7) / 8;
+    for (int64_t n = 0; n < nbytes; n++) {
+        int64_t i = (alloc_hint + n) % nbytes;
         if (bitmap[i] == 0xFF) continue; // Byte is full
 
         for (int bit = 0; bit < 8; bit++) {
+            int64_t block_idx = (i * 8) + bit;
+            if (block_idx >= sb.total_blocks) break;
             // Check if bit is 0 (free)
             if (!((bitmap[i] >> bit) & 1)) {
                 // Set bit to 1 (used)
                 bitmap[i] |= (1 << bit);
-                fs_save_bitmap();
+                fs_save_bitmap_block(block_idx);
+                alloc_hint = i;
 
-                int block_idx = (i * 8) + bit;
-                // Zero out the block on disk to be safe
-                int32_t phys_addr = block_idx * BLOCK_SIZE;
-                
                 // Optional: zero out the actual block on disk
                 /*
                 char zeros[BLOCK_SIZE] = {0};
-                fseek(disk, phys_addr, SEEK_SET);
-                fwrite(zeros, 1, BLOCK_SIZE, disk);
+                io_write(zeros, BLOCK_SIZE, BLOCK_OFF(block_idx));
                 */
                 
-                return phys_addr;
+                return block_idx;
             }
         }
     }
@@ -73,35 +114,712 @@ int32_t alloc_block() {
     return -1;
 }
 
-void free_block(int32_t addr) {
+// Data blocks may be shared by several files (see DEDUPLICATION);
+// the block is only released when its last reference goes away
+void free_block(int64_t addr) {
     if (addr < 0) return;
-    int block_idx = addr / BLOCK_SIZE;
-    
-    int byte_idx = block_idx / 8;
-    int bit_idx = block_idx % 8;
 
+    DedupEntry *e = dedup_block(addr);
+    if (e && e->refs > 1) {
+        e->refs--;
+        return;
+    }
+    if (e) dedup_remove(addr);
+    
     // Set bit to 0 (free)
-    bitmap[byte_idx] &= ~(1 << bit_idx);
-    fs_save_bitmap();
+    bitmap[addr / 8] &= ~(1 << (addr % 8));
+    fs_save_bitmap_block(addr);
+}
+
+// --- DEDUPLICATION ---
+// Data blocks are content addressed: a fingerprint index maps the stored
+// bytes of every data block to its address, so identical blocks are kept
+// once and shared copy-on-write. The index lives in memory only and is
+// rebuilt from the file list at mount. It is sized by the data blocks in
+// use, not by the image: both tables start small and double on demand.
+
+uint64_t dedup_fingerprint(const uint8_t *data, int len) {
+    // FNV-1a 64
+    uint64_t h = 1469598103934665603ULL;
+    for (int i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Block addresses are dense, so they are mixed before masking
+// (fingerprints already are)
+int64_t dedup_addr_home(int64_t addr) {
+    uint64_t x = (uint64_t)addr;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (int64_t)(x & (uint64_t)(dedup_slots - 1));
+}
+
+int64_t dedup_fp_home(uint64_t fp) { return (int64_t)(fp & (uint64_t)(dedup_slots - 1)); }
+
+// Slot holding addr, or the empty slot where it would go
+int64_t dedup_block_slot(int64_t addr) {
+    int64_t slot = dedup_addr_home(addr);
+    while (dedup_blocks[slot].addr != -1 && dedup_blocks[slot].addr != addr) {
+        slot = (slot + 1) & (dedup_slots - 1);
+    }
+    return slot;
+}
+
+DedupEntry *dedup_block(int64_t addr) {
+    if (addr < 0) return NULL;
+    DedupEntry *e = &dedup_blocks[dedup_block_slot(addr)];
+    return e->addr == addr ? e : NULL;
+}
+
+uint32_t dedup_refs(int64_t addr) {
+    DedupEntry *e = dedup_block(addr);
+    return e ? e->refs : 0;
+}
+
+void dedup_add_link(uint64_t fp, int64_t addr) {
+    int64_t slot = dedup_fp_home(fp);
+    while (dedup_links[slot].addr != -1) slot = (slot + 1) & (dedup_slots - 1);
+    dedup_links[slot].fp = fp;
+    dedup_links[slot].addr = addr;
+}
+
+// Allocates both tables with `slots` empty slots; -1 if memory runs out
+int dedup_alloc(int64_t slots, DedupEntry **blocks, DedupLink **links) {
+    *blocks = malloc(slots * sizeof(DedupEntry));
+    *links = malloc(slots * sizeof(DedupLink));
+    if (!*blocks || !*links) {
+        free(*blocks);
+        free(*links);
+        return -1;
+    }
+    for (int64_t i = 0; i < slots; i++) {
+        (*blocks)[i].addr = -1;
+        (*links)[i].addr = -1;
+    }
+    return 0;
+}
+
+// Empties the index. Only runs while mounting or repairing, where the image
+// is unusable without it.
+void dedup_reset() {
+    free(dedup_blocks);
+    free(dedup_links);
+    dedup_slots = DEDUP_MIN_SLOTS;
+    if (dedup_alloc(dedup_slots, &dedup_blocks, &dedup_links) == -1) {
+        printf("Out of memory for the dedup index.\n");
+        exit(1);
+    }
+    dedup_count = 0;
+    dedup_hits = 0;
+    dedup_lookups = 0;
+}
+
+// Makes room for n more blocks, doubling both tables until the load factor
+// stays <= 0.5. Returns -1 if memory runs out; the index is then unchanged.
+int dedup_reserve(int64_t n) {
+    int64_t slots = dedup_slots;
+    while (2 * (dedup_count + n) > slots) slots <<= 1;
+    if (slots == dedup_slots) return 0;
+
+    DedupEntry *blocks;
+    DedupLink *links;
+    if (dedup_alloc(slots, &blocks, &links) == -1) return -1;
+    DedupEntry *old_blocks = dedup_blocks;
+    DedupLink *old_links = dedup_links;
+    int64_t old_slots = dedup_slots;
+    dedup_blocks = blocks;
+    dedup_links = links;
+    dedup_slots = slots;
+    // Each table is rehashed from its own entries: while dedup_rebuild
+    // counts references, blocks have no fingerprint (and no link) yet
+    for (int64_t i = 0; i < old_slots; i++) {
+        if (old_blocks[i].addr != -1) dedup_blocks[dedup_block_slot(old_blocks[i].addr)] = old_blocks[i];
+        if (old_links[i].addr != -1) dedup_add_link(old_links[i].fp, old_links[i].addr);
+    }
+    free(old_blocks);
+    free(old_links);
+    return 0;
+}
+
+// Adds a block with no references and no link; dedup_reserve must have
+// made room
+DedupEntry *dedup_add_block(int64_t addr, int32_t len) {
+    DedupEntry *e = &dedup_blocks[dedup_block_slot(addr)];
+    e->addr = addr;
+    e->fp = 0;
+    e->len = len;
+    e->refs = 0;
+    dedup_count++;
+    return e;
+}
+
+// Indexes a freshly stored block with one reference
+void dedup_insert(int64_t addr, uint64_t fp, int32_t len) {
+    DedupEntry *e = dedup_add_block(addr, len);
+    e->fp = fp;
+    e->refs = 1;
+    dedup_add_link(fp, addr);
+}
+
+// An entry at j may move back into the hole unless its home lies
+// cyclically in (hole, j]
+int dedup_stays(int64_t hole, int64_t j, int64_t home) {
+    return (hole <= j) ? (home > hole && home <= j) : (home > hole || home <= j);
+}
+
+// Linear probing with backward-shift deletion (no tombstones)
+void dedup_remove(int64_t addr) {
+    int64_t hole = dedup_block_slot(addr);
+    if (dedup_blocks[hole].addr == -1) return;
+    uint64_t fp = dedup_blocks[hole].fp;
+    for (int64_t j = hole; ; ) {
+        j = (j + 1) & (dedup_slots - 1);
+        if (dedup_blocks[j].addr == -1) break;
+        if (!dedup_stays(hole, j, dedup_addr_home(dedup_blocks[j].addr))) {
+            dedup_blocks[hole] = dedup_blocks[j];
+            hole = j;
+        }
+    }
+    dedup_blocks[hole].addr = -1;
+    dedup_count--;
+
+    hole = dedup_fp_home(fp);
+    while (dedup_links[hole].addr != addr) {
+        if (dedup_links[hole].addr == -1) return;
+        hole = (hole + 1) & (dedup_slots - 1);
+    }
+    for (int64_t j = hole; ; ) {
+        j = (j + 1) & (dedup_slots - 1);
+        if (dedup_links[j].addr == -1) break;
+        if (!dedup_stays(hole, j, dedup_fp_home(dedup_links[j].fp))) {
+            dedup_links[hole] = dedup_links[j];
+            hole = j;
+        }
+    }
+    dedup_links[hole].addr = -1;
+}
+
+// Returns the address of a block holding exactly data[0..len), or -1
+int64_t dedup_lookup(uint64_t fp, const uint8_t *data, int len) {
+    dedup_lookups++;
+    int64_t slot = dedup_fp_home(fp);
+    while (dedup_links[slot].addr != -1) {
+        DedupLink *l = &dedup_links[slot];
+        DedupEntry *e = l->fp == fp ? dedup_block(l->addr) : NULL;
+        if (e && e->len == len) {
+            // Fingerprints only nominate a candidate; bytes decide
+            uint8_t stored[BLOCK_SIZE];
+            io_read(stored, len, BLOCK_OFF(e->addr));
+            if (memcmp(stored, data, len) == 0) return e->addr;
+        }
+        slot = (slot + 1) & (dedup_slots - 1);
+    }
+    return -1;
+}
+
+void dedup_rebuild() {
+    dedup_reset();
+
+    // Pass 1: walk the file list, counting references per distinct data block
+    int64_t pos = sb.first_file;
+    // A list cannot hold more entries than there are blocks; stop on cycles
+    for (int64_t hops = 0; pos != -1; hops++) {
+        if (hops == sb.total_blocks || !fsck_valid_addr(pos)) {
+            printf("File list is corrupt, run fsck.\n");
+            break;
+        }
+        FileEntry fe;
+        io_read(&fe, sizeof(FileEntry), BLOCK_OFF(pos));
+        if (fe.data_block != -1 && fsck_valid_addr(fe.data_block) &&
+            fe.stored_size >= 0 && fe.stored_size <= BLOCK_SIZE) {
+            DedupEntry *e = dedup_block(fe.data_block);
+            if (!e) {
+                if (dedup_reserve(1) == -1) {
+                    printf("Out of memory for the dedup index.\n");
+                    exit(1);
+                }
+                e = dedup_add_block(fe.data_block, fe.stored_size);
+            }
+            e->refs++;
+        }
+        pos = fe.next;
+    }
+
+    // Pass 2: fingerprint every distinct block. The reads are independent,
+    // so fetch them in batches; linking does not move the block entries.
+    uint8_t *bufs = malloc(IO_QUEUE_DEPTH * BLOCK_SIZE);
+    if (!bufs) {
+        printf("Out of memory for the dedup index.\n");
+        exit(1);
+    }
+    DedupEntry *batch[IO_QUEUE_DEPTH];
+    int count = 0;
+    for (int64_t i = 0; i <= dedup_slots; i++) {
+        if (i < dedup_slots && dedup_blocks[i].addr != -1) batch[count++] = &dedup_blocks[i];
+        if (count == IO_QUEUE_DEPTH || (i == dedup_slots && count > 0)) {
+            io_batch_begin();
+            for (int k = 0; k < count; k++) io_queue_read(bufs + k * BLOCK_SIZE, batch[k]->len, BLOCK_OFF(batch[k]->addr));
+            io_batch_end();
+            for (int k = 0; k < count; k++) {
+                batch[k]->fp = dedup_fingerprint(bufs + k * BLOCK_SIZE, batch[k]->len);
+                dedup_add_link(batch[k]->fp, batch[k]->addr);
+            }
+            count = 0;
+        }
+    }
+    free(bufs);
+}
+
+// Stores data[0..len) as fe's data block. Shares an identical block when one
+// exists, overwrites in place when fe owns its block alone, and otherwise
+// copies on write. Updates fe->data_block and fe->stored_size.
+int fs_store_block(FileEntry *fe, const uint8_t *data, int len) {
+    // Room for a new entry first, so the store cannot fail halfway
+    if (dedup_reserve(1) == -1) {
+        printf("Out of memory for the dedup index.\n");
+        return -1;
+    }
+    uint64_t fp = dedup_fingerprint(data, len);
+    int64_t old = fe->data_block;
+
+    int64_t match = dedup_lookup(fp, data, len);
+    DedupEntry *m = match != -1 ? dedup_block(match) : NULL;
+    // A saturated count cannot take another sharer; store a fresh copy
+    if (m && match != old && m->refs == UINT32_MAX) match = -1;
+    if (match != -1) {
+        dedup_hits++;
+        if (match != old) {
+            m->refs++;
+            free_block(old);
+            fe->data_block = match;
+        }
+        fe->stored_size = len;
+        return 0;
+    }
+
+    int64_t addr;
+    DedupEntry *o = dedup_block(old);
+    if (o && o->refs == 1) {
+        dedup_remove(old);
+        addr = old;
+    } else {
+        addr = alloc_block();
+        if (addr == -1) return -1;
+        free_block(old);
+    }
+
+    io_write(data, len, BLOCK_OFF(addr));
+    dedup_insert(addr, fp, len);
+
+    fe->data_block = addr;
+    fe->stored_size = len;
+    return 0;
+}
+
+// --- COMPRESSION (LZ) ---
+// LZ4-style block format: each sequence is a token (high nibble = literal
+// count, low nibble = match length - 4), optional length extension bytes
+// (runs of 255), the literals, then a 2-byte little endian match offset.
+// The stream always ends with a literals-only sequence.
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+
+uint32_t lz_hash(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Writes the extension bytes of a length that did not fit in its nibble
+int lz_put_len(uint8_t *dst, int op, int cap, int len) {
+    while (len >= 255) {
+        if (op >= cap) return -1;
+        dst[op++] = 255;
+        len -= 255;
+    }
+    if (op >= cap) return -1;
+    dst[op++] = (uint8_t)len;
+    return op;
+}
+
+// Returns the packed length, or -1 if it does not fit in cap bytes
+int lz_compress(const uint8_t *src, int n, uint8_t *dst, int cap) {
+    int32_t table[1 << LZ_HASH_BITS];
+    for (int i = 0; i < (1 << LZ_HASH_BITS); i++) table[i] = -1;
+
+    int ip = 0, anchor = 0, op = 0;
+    while (ip + LZ_MIN_MATCH <= n) {
+        uint32_t h = lz_hash(src + ip);
+        int32_t ref = table[h];
+        table[h] = ip;
+        if (ref == -1 || ip - ref > 0xFFFF || memcmp(src + ref, src + ip, LZ_MIN_MATCH) != 0) {
+            ip++;
+            continue;
+        }
+
+        int mlen = LZ_MIN_MATCH;
+        while (ip + mlen < n && src[ref + mlen] == src[ip + mlen]) mlen++;
+
+        int lit = ip - anchor;
+        int mcode = mlen - LZ_MIN_MATCH;
+        if (op >= cap) return -1;
+        dst[op++] = (uint8_t)(((lit < 15 ? lit : 15) << 4) | (mcode < 15 ? mcode : 15));
+        if (lit >= 15 && (op = lz_put_len(dst, op, cap, lit - 15)) == -1) return -1;
+        if (op + lit + 2 > cap) return -1;
+        memcpy(dst + op, src + anchor, lit);
+        op += lit;
+        dst[op++] = (uint8_t)((ip - ref) & 0xFF);
+        dst[op++] = (uint8_t)((ip - ref) >> 8);
+        if (mcode >= 15 && (op = lz_put_len(dst, op, cap, mcode - 15)) == -1) return -1;
+
+        ip += mlen;
+        anchor = ip;
+    }
+
+    // Trailing literals
+    int lit = n - anchor;
+    if (op >= cap) return -1;
+    dst[op++] = (uint8_t)((lit < 15 ? lit : 15) << 4);
+    if (lit >= 15 && (op = lz_put_len(dst, op, cap, lit - 15)) == -1) return -1;
+    if (op + lit > cap) return -1;
+    memcpy(dst + op, src + anchor, lit);
+    return op + lit;
+}
+
+// Returns the unpacked length, or -1 if the stream is corrupt or exceeds cap
+int lz_decompress(const uint8_t *src, int n, uint8_t *dst, int cap) {
+    int ip = 0, op = 0;
+    while (ip < n) {
+        int token = src[ip++];
+
+        int lit = token >> 4;
+        if (lit == 15) {
+            int b;
+            do {
+                if (ip >= n) return -1;
+                b = src[ip++];
+                lit += b;
+            } while (b == 255);
+        }
+        if (ip + lit > n || op + lit > cap) return -1;
+        memcpy(dst + op, src + ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == n) break; // Literals-only sequence ends the stream
+
+        if (ip + 2 > n) return -1;
+        int offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+
+        int mlen = token & 15;
+        if (mlen == 15) {
+            int b;
+            do {
+                if (ip >= n) return -1;
+                b = src[ip++];
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || op + mlen > cap) return -1;
+        // Byte-wise copy: the match may overlap the bytes it produces
+        for (int i = 0; i < mlen; i++, op++) dst[op] = dst[op - offset];
+    }
+    return op;
+}
+
+// --- NAME INDEX (B+TREE) ---
+// Maps file names to FileEntry addresses for O(log n) lookups and sorted
+// range scans. Deletes never merge nodes: a leaf may shrink to zero keys and
+// stays in the sibling chain, which scans simply step over.
+
+int bt_cmp(const char *a, const char *b) { return strncmp(a, b, MAX_FILENAME); }
+
+// First slot whose key is >= key
+int bt_lower_bound(BTreeNode *n, const char *key) {
+    int lo = 0, hi = n->nkeys;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (bt_cmp(n->keys[mid], key) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Child of an internal node that covers key
+int bt_child_slot(BTreeNode *n, const char *key) {
+    int lo = 0, hi = n->nkeys;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (bt_cmp(key, n->keys[mid]) < 0) hi = mid;
+        else lo = mid + 1;
+    }
+    return lo;
+}
+
+void bt_init_node(BTreeNode *n, int is_leaf) {
+    memset(n, 0, sizeof(BTreeNode));
+    n->is_leaf = is_leaf;
+    n->next = -1;
+}
+
+int64_t bt_alloc_node(BTreeNode *n, int is_leaf) {
+    bt_init_node(n, is_leaf);
+    return alloc_block();
+}
+
+// Loads the leaf that covers key into leaf; returns its address
+int64_t bt_find_leaf(const char *key, BTreeNode *leaf) {
+    int64_t addr = sb.btree_root;
+    for (int depth = 0; addr != -1 && depth < BT_MAX_DEPTH; depth++) {
+        io_read(leaf, sizeof(BTreeNode), BLOCK_OFF(addr));
+        if (leaf->is_leaf) return addr;
+        addr = leaf->vals[bt_child_slot(leaf, key)];
+    }
+    return -1;
+}
+
+int64_t bt_lookup(const char *key) {
+    BTreeNode leaf;
+    if (bt_find_leaf(key, &leaf) == -1) return -1;
+    int i = bt_lower_bound(&leaf, key);
+    if (i < leaf.nkeys && bt_cmp(leaf.keys[i], key) == 0) return leaf.vals[i];
+    return -1;
+}
+
+// Returns -1 (leaving the tree untouched) if the nodes a split needs
+// cannot be allocated
+int bt_insert(const char *key, int64_t val) {
+    // Every node touched stays in these arrays until the batch is flushed
+    BTreeNode path[BT_MAX_DEPTH], right[BT_MAX_DEPTH], root;
+    int64_t addrs[BT_MAX_DEPTH];
+    int slots[BT_MAX_DEPTH];
+
+    if (sb.btree_root == -1) { printf("Name index missing, run fsck.\n"); return -1; }
+    int depth = 0;
+    int64_t addr = sb.btree_root;
+    while (1) {
+        io_read(&path[depth], sizeof(BTreeNode), BLOCK_OFF(addr));
+        addrs[depth] = addr;
+        if (path[depth].is_leaf) break;
+        if (depth == BT_MAX_DEPTH - 1) { printf("Name index too deep, run fsck.\n"); return -1; }
+        slots[depth] = bt_child_slot(&path[depth], key);
+        addr = path[depth].vals[slots[depth]];
+        depth++;
+    }
+
+    io_batch_begin();
+    BTreeNode *leaf = &path[depth];
+    int i = bt_lower_bound(leaf, key);
+    if (i < leaf->nkeys && bt_cmp(leaf->keys[i], key) == 0) {
+        leaf->vals[i] = val;
+        io_write(leaf, sizeof(BTreeNode), BLOCK_OFF(addrs[depth]));
+        io_batch_end();
+        return 0;
+    }
+
+    // Full nodes split from the leaf up (and a new root if the root splits);
+    // allocate them all first so a full disk cannot strand half a split
+    int64_t spare[BT_MAX_DEPTH + 1];
+    int need = 0;
+    for (int level = depth; level >= 0 && path[level].nkeys == BT_MAX_KEYS; level--) need++;
+    if (need == depth + 1) need++;
+    for (int k = 0; k < need; k++) {
+        spare[k] = alloc_block();
+        if (spare[k] == -1) {
+            while (k > 0) free_block(spare[--k]);
+            io_batch_end();
+            return -1;
+        }
+    }
+    int used = 0;
+    memmove(leaf->keys[i + 1], leaf->keys[i], (leaf->nkeys - i) * MAX_FILENAME);
+    memmove(&leaf->vals[i + 1], &leaf->vals[i], (leaf->nkeys - i) * sizeof(int64_t));
+    memset(leaf->keys[i], 0, MAX_FILENAME);
+    strncpy(leaf->keys[i], key, MAX_FILENAME - 1);
+    leaf->vals[i] = val;
+    leaf->nkeys++;
+
+    // Split overflowing nodes bottom-up, pushing a separator into the parent
+    char up_key[MAX_FILENAME];
+    int64_t up_child = -1;
+    for (int level = depth; level >= 0; level--) {
+        BTreeNode *n = &path[level];
+        if (up_child != -1) {
+            int slot = slots[level];
+            memmove(n->keys[slot + 1], n->keys[slot], (n->nkeys - slot) * MAX_FILENAME);
+            memmove(&n->vals[slot + 2], &n->vals[slot + 1], (n->nkeys - slot) * sizeof(int64_t));
+            memcpy(n->keys[slot], up_key, MAX_FILENAME);
+            n->vals[slot + 1] = up_child;
+            n->nkeys++;
+            up_child = -1;
+        }
+        if (n->nkeys <= BT_MAX_KEYS) {
+            io_write(n, sizeof(BTreeNode), BLOCK_OFF(addrs[level]));
+            break;
+        }
+
+        BTreeNode *r = &right[level];
+        bt_init_node(r, n->is_leaf);
+        int64_t r_addr = spare[used++];
+        int mid = n->nkeys / 2;
+        if (n->is_leaf) {
+            r->nkeys = n->nkeys - mid;
+            memcpy(r->keys, n->keys[mid], r->nkeys * MAX_FILENAME);
+            memcpy(r->vals, &n->vals[mid], r->nkeys * sizeof(int64_t));
+            r->next = n->next;
+            n->next = r_addr;
+            n->nkeys = mid;
+            memcpy(up_key, r->keys[0], MAX_FILENAME);
+        } else {
+            // keys[mid] moves up; children right of it go to the new node
+            r->nkeys = n->nkeys - mid - 1;
+            memcpy(r->keys, n->keys[mid + 1], r->nkeys * MAX_FILENAME);
+            memcpy(r->vals, &n->vals[mid + 1], (r->nkeys + 1) * sizeof(int64_t));
+            memcpy(up_key, n->keys[mid], MAX_FILENAME);
+            n->nkeys = mid;
+        }
+        memset(n->keys[n->nkeys], 0, (BT_MAX_KEYS + 1 - n->nkeys) * MAX_FILENAME);
+        io_write(n, sizeof(BTreeNode), BLOCK_OFF(addrs[level]));
+        io_write(r, sizeof(BTreeNode), BLOCK_OFF(r_addr));
+        up_child = r_addr;
+    }
+
+    // The root itself split: grow the tree by one level
+    if (up_child != -1) {
+        int64_t root_addr = spare[used++];
+        bt_init_node(&root, 0);
+        root.nkeys = 1;
+        memcpy(root.keys[0], up_key, MAX_FILENAME);
+        root.vals[0] = sb.btree_root;
+        root.vals[1] = up_child;
+        io_write(&root, sizeof(BTreeNode), BLOCK_OFF(root_addr));
+        sb.btree_root = root_addr;
+        fs_save_superblock();
+    }
+    io_batch_end();
+    return 0;
+}
+
+void bt_delete(const char *key) {
+    BTreeNode leaf;
+    int64_t addr = bt_find_leaf(key, &leaf);
+    if (addr == -1) return;
+    int i = bt_lower_bound(&leaf, key);
+    if (i == leaf.nkeys || bt_cmp(leaf.keys[i], key) != 0) return;
+    memmove(leaf.keys[i], leaf.keys[i + 1], (leaf.nkeys - i - 1) * MAX_FILENAME);
+    memmove(&leaf.vals[i], &leaf.vals[i + 1], (leaf.nkeys - i - 1) * sizeof(int64_t));
+    leaf.nkeys--;
+    memset(leaf.keys[leaf.nkeys], 0, MAX_FILENAME);
+    io_write(&leaf, sizeof(BTreeNode), BLOCK_OFF(addr));
+}
+
+// Drops the current index (its blocks must already be free or unclaimed)
+// and re-inserts every file in the list
+void bt_rebuild() {
+    BTreeNode root;
+    int64_t root_addr = bt_alloc_node(&root, 1);
+    if (root_addr == -1) return;
+    io_write(&root, sizeof(BTreeNode), BLOCK_OFF(root_addr));
+    sb.btree_root = root_addr;
+    fs_save_superblock();
+
+    int64_t pos = sb.first_file;
+    int missed = 0;
+    // A list cannot hold more entries than there are blocks; stop on cycles
+    for (int64_t hops = 0; pos != -1; hops++) {
+        if (hops == sb.total_blocks || !fsck_valid_addr(pos)) {
+            printf("File list is corrupt, run fsck.\n");
+            break;
+        }
+        FileEntry fe;
+        io_read(&fe, sizeof(FileEntry), BLOCK_OFF(pos));
+        if (bt_insert(fe.name, pos) == -1) missed++;
+        pos = fe.next;
+    }
+    if (missed) printf("Name index is missing %d file(s): disk full.\n", missed);
+}
+
+// Range scan: names starting with prefix that sort strictly after `after`
+// (NULL starts at the prefix). Reads the root-to-leaf path once, then only
+// the leaves the page spans. Pass the last name back as `after` to page on.
+// The leaf values come along in addrs, so callers need no lookups.
+int fs_list(const char *prefix, const char *after, int limit, char names[][MAX_FILENAME],
+            int64_t *addrs) {
+    if (!prefix) prefix = "";
+    size_t plen = strlen(prefix);
+    const char *start = (after && bt_cmp(after, prefix) > 0) ? after : prefix;
+
+    BTreeNode leaf;
+    if (bt_find_leaf(start, &leaf) == -1) return 0;
+    int i = bt_lower_bound(&leaf, start);
+
+    int count = 0;
+    while (count < limit) {
+        if (i == leaf.nkeys) {
+            if (leaf.next == -1) break;
+            io_read(&leaf, sizeof(BTreeNode), BLOCK_OFF(leaf.next));
+            i = 0;
+            continue;
+        }
+        const char *key = leaf.keys[i];
+        int64_t val = leaf.vals[i++];
+        if (strncmp(key, prefix, plen) != 0) break;
+        if (after && bt_cmp(key, after) <= 0) continue;
+        if (addrs) addrs[count] = val;
+        memcpy(names[count++], key, MAX_FILENAME);
+    }
+    return count;
+}
+
+void fs_ls(const char *prefix) {
+    char names[LS_PAGE_SIZE][MAX_FILENAME];
+    int64_t addrs[LS_PAGE_SIZE];
+    FileEntry fes[LS_PAGE_SIZE];
+    char last[MAX_FILENAME];
+    int total = 0;
+    int n = fs_list(prefix, NULL, LS_PAGE_SIZE, names, addrs);
+    while (n > 0) {
+        // The page's entries are independent reads: fetch them as one batch
+        io_batch_begin();
+        for (int i = 0; i < n; i++) io_queue_read(&fes[i], sizeof(FileEntry), BLOCK_OFF(addrs[i]));
+        io_batch_end();
+        for (int i = 0; i < n; i++) {
+            FileEntry *fe = &fes[i];
+            printf("%04o %4d %4d %6d%s %s\n", fe->permission, fe->uid, fe->gid, fe->size,
+                   (fe->flags & FE_PACKED) ? "z" : " ", fe->name);
+        }
+        total += n;
+        if (n < LS_PAGE_SIZE) break;
+        memcpy(last, names[n - 1], MAX_FILENAME);
+        n = fs_list(prefix, last, LS_PAGE_SIZE, names, addrs);
+    }
+    printf("%d file(s).\n", total);
 }
 
 // --- INITIALIZATION ---
 
 void fs_create_root_user() {
+    io_batch_begin();
+
     // Create Root Group
-    int32_t g_pos = alloc_block();
+    int64_t g_pos = alloc_block();
     Group root_group;
     root_group.gid = 0;
     strcpy(root_group.groupname, "root");
     root_group.next = -1;
-    fseek(disk, g_pos, SEEK_SET);
-    fwrite(&root_group, sizeof(Group), 1, disk);
+    io_write(&root_group, sizeof(Group), BLOCK_OFF(g_pos));
 
     sb.first_group = g_pos;
     sb.next_gid = 1;
 
     // Create Root User
-    int32_t u_pos = alloc_block();
+    int64_t u_pos = alloc_block();
     User root_user;
     root_user.uid = 0;
     strcpy(root_user.username, "root");
@@ -109,13 +827,13 @@ void fs_create_root_user() {
     root_user.gids[0] = 0; 
     root_user.next = -1;
 
-    fseek(disk, u_pos, SEEK_SET);
-    fwrite(&root_user, sizeof(User), 1, disk);
+    io_write(&root_user, sizeof(User), BLOCK_OFF(u_pos));
 
     sb.first_user = u_pos;
     sb.next_uid = 1;
 
     fs_save_superblock();
+    io_batch_end();
 
     current_uid = 0;
     current_gid = 0;
@@ -123,45 +841,79 @@ void fs_create_root_user() {
     current_user_groups[0] = 0;
 }
 
+void fs_set_io_backend(int backend) { io_mode = backend; }
+
+void fs_set_format_blocks(int64_t blocks) { format_blocks = blocks; }
+
 void fs_open_disk() {
-    disk = fopen("filesys.db", "r+b");
-    if (!disk) {
+    if (io_open("filesys.db", 0, io_mode) == -1) {
         printf("Formatting new filesystem (Bitmap Mode)...\n");
-        disk = fopen("filesys.db", "w+b");
-        if (!disk) { perror("Error creating disk"); exit(1); }
+        if (io_open("filesys.db", 1, io_mode) == -1) { perror("Error creating disk"); exit(1); }
 
         // Expand file to full size immediately to avoid seek errors
-        fseek(disk, DISK_SIZE - 1, SEEK_SET);
-        fputc(0, disk);
-        rewind(disk);
+        char zero = 0;
+        io_write(&zero, 1, BLOCK_OFF(format_blocks) - 1);
 
         sb.magic = MAGIC;
-        sb.version = 3; 
+        sb.version = FS_VERSION;
+        sb.block_size = BLOCK_SIZE;
         sb.file_count = 0;
         sb.first_file = -1;
         sb.first_user = -1;
         sb.first_group = -1;
 
+        // Geometry: the bitmap follows the SuperBlock
+        sb.total_blocks = format_blocks;
+        sb.bitmap_start = 1;
+        sb.bitmap_blocks = (format_blocks + BITS_PER_BITMAP_BLOCK - 1) / BITS_PER_BITMAP_BLOCK;
+
         // Init Bitmap
-        memset(bitmap, 0, BLOCK_SIZE);
-        // Reserve Block 0 (SuperBlock) and Block 1 (Bitmap itself)
-        bitmap[0] |= 1; // 0th bit
-        bitmap[0] |= 2; // 1st bit
+        free(bitmap);
+        bitmap = calloc(sb.bitmap_blocks, BLOCK_SIZE);
+        if (!bitmap) { printf("Out of memory for the bitmap.\n"); exit(1); }
+        alloc_hint = 0;
+        // Reserve Block 0 (SuperBlock) and the Bitmap blocks themselves
+        for (int64_t b = 0; b < sb.bitmap_start + sb.bitmap_blocks; b++) {
+            bitmap[b / 8] |= (1 << (b % 8));
+        }
 
-        fwrite(&sb, sizeof(SuperBlock), 1, disk); // Block 0
-        fs_save_bitmap(); // Block 1
+        io_write(&sb, sizeof(SuperBlock), 0); // Block 0
+        fs_save_bitmap(); // Blocks 1..bitmap_blocks
 
+        dedup_reset();
+        sb.btree_root = -1;
         fs_create_root_user();
+        bt_rebuild(); // Empty root leaf
         printf("Filesystem initialized.\n");
     } else {
-        fread(&sb, sizeof(SuperBlock), 1, disk);
+        io_read(&sb, sizeof(SuperBlock), 0);
         if (sb.magic != MAGIC) {
             printf("Invalid filesystem magic.\n");
             exit(1);
         }
-        // Load Bitmap
-        fseek(disk, BLOCK_SIZE, SEEK_SET);
-        fread(bitmap, BLOCK_SIZE, 1, disk);
+        if (sb.version != FS_VERSION) {
+            printf("Unsupported filesystem version %d (expected %d). Remove filesys.db to reformat.\n", sb.version, FS_VERSION);
+            exit(1);
+        }
+        if (sb.block_size != BLOCK_SIZE || sb.total_blocks < 2 ||
+            sb.bitmap_blocks * BITS_PER_BITMAP_BLOCK < sb.total_blocks) {
+            printf("Invalid filesystem geometry (block size %d, %lld blocks).\n",
+                   sb.block_size, (long long)sb.total_blocks);
+            exit(1);
+        }
+        // Load Bitmap (independent block reads, fetched in batches)
+        free(bitmap);
+        bitmap = malloc(sb.bitmap_blocks * BLOCK_SIZE);
+        if (!bitmap) { printf("Out of memory for the bitmap.\n"); exit(1); }
+        alloc_hint = 0;
+        for (int64_t i = 0; i < sb.bitmap_blocks; i += IO_QUEUE_DEPTH) {
+            io_batch_begin();
+            for (int64_t k = i; k < sb.bitmap_blocks && k < i + IO_QUEUE_DEPTH; k++) {
+                io_queue_read(bitmap + k * BLOCK_SIZE, BLOCK_SIZE, BLOCK_OFF(sb.bitmap_start + k));
+            }
+            io_batch_end();
+        }
+        dedup_rebuild();
 
         current_uid = 0;
         current_gid = 0;
@@ -171,34 +923,24 @@ void fs_open_disk() {
 
 // --- LOOKUP HELPERS ---
 
-int32_t fs_find_file(const char *filename) {
-    int32_t pos = sb.first_file;
-    while (pos != -1) {
-        FileEntry fe;
-        fseek(disk, pos, SEEK_SET);
-        fread(&fe, sizeof(FileEntry), 1, disk);
-        if (strcmp(fe.name, filename) == 0) return pos;
-        pos = fe.next;
-    }
-    return -1;
+int64_t fs_find_file(const char *filename) {
+    return bt_lookup(filename);
 }
 
-int32_t find_user_by_name(const char* name, User* out_user) {
-    int32_t pos = sb.first_user;
+int64_t find_user_by_name(const char* name, User* out_user) {
+    int64_t pos = sb.first_user;
     while(pos != -1) {
-        fseek(disk, pos, SEEK_SET);
-        fread(out_user, sizeof(User), 1, disk);
+        io_read(out_user, sizeof(User), BLOCK_OFF(pos));
         if(strcmp(out_user->username, name) == 0) return pos;
         pos = out_user->next;
     }
     return -1;
 }
 
-int32_t find_group_by_name(const char* name, Group* out_group) {
-    int32_t pos = sb.first_group;
+int64_t find_group_by_name(const char* name, Group* out_group) {
+    int64_t pos = sb.first_group;
     while(pos != -1) {
-        fseek(disk, pos, SEEK_SET);
-        fread(out_group, sizeof(Group), 1, disk);
+        io_read(out_group, sizeof(Group), BLOCK_OFF(pos));
         if(strcmp(out_group->groupname, name) == 0) return pos;
         pos = out_group->next;
     }
@@ -206,11 +948,10 @@ int32_t find_group_by_name(const char* name, Group* out_group) {
 }
 
 void reload_current_user_groups() {
-    int32_t pos = sb.first_user;
+    int64_t pos = sb.first_user;
     while(pos != -1) {
         User u;
-        fseek(disk, pos, SEEK_SET);
-        fread(&u, sizeof(User), 1, disk);
+        io_read(&u, sizeof(User), BLOCK_OFF(pos));
         if (u.uid == current_uid) {
             current_gid = u.gids[0]; 
             memcpy(current_user_groups, u.gids, sizeof(u.gids));
@@ -234,8 +975,9 @@ void fs_useradd(const char *username) {
     if (current_uid != 0) { printf("Permission denied.\n"); return; }
     
     // Alloc 1 block
-    int32_t pos = alloc_block();
-    if (pos == -1) return;
+    io_batch_begin();
+    int64_t pos = alloc_block();
+    if (pos == -1) { io_batch_end(); return; }
 
     User u;
     u.uid = sb.next_uid++;
@@ -243,11 +985,11 @@ void fs_useradd(const char *username) {
     for(int i=0; i<MAX_USER_GROUPS; i++) u.gids[i] = -1;
     u.next = sb.first_user;
 
-    fseek(disk, pos, SEEK_SET);
-    fwrite(&u, sizeof(User), 1, disk);
+    io_write(&u, sizeof(User), BLOCK_OFF(pos));
 
     sb.first_user = pos;
     fs_save_superblock();
+    io_batch_end();
     printf("User added.\n");
 }
 
@@ -255,21 +997,18 @@ void fs_userdel(const char *username) {
     if (current_uid != 0) { printf("Permission denied.\n"); return; }
     if (strcmp(username, "root") == 0) return;
 
-    int32_t prev = -1;
-    int32_t curr = sb.first_user;
+    int64_t prev = -1;
+    int64_t curr = sb.first_user;
     while(curr != -1) {
         User u;
-        fseek(disk, curr, SEEK_SET);
-        fread(&u, sizeof(User), 1, disk);
+        io_read(&u, sizeof(User), BLOCK_OFF(curr));
         if (strcmp(u.username, username) == 0) {
             if (prev == -1) sb.first_user = u.next;
             else {
                 User p;
-                fseek(disk, prev, SEEK_SET);
-                fread(&p, sizeof(User), 1, disk);
+                io_read(&p, sizeof(User), BLOCK_OFF(prev));
                 p.next = u.next;
-                fseek(disk, prev, SEEK_SET);
-                fwrite(&p, sizeof(User), 1, disk);
+                io_write(&p, sizeof(User), BLOCK_OFF(prev));
             }
             free_block(curr); // Free the block
             fs_save_superblock();
@@ -284,40 +1023,38 @@ void fs_userdel(const char *username) {
 void fs_groupadd(const char *groupname) {
     if (current_uid != 0) { printf("Permission denied.\n"); return; }
 
-    int32_t pos = alloc_block();
-    if (pos == -1) return;
+    io_batch_begin();
+    int64_t pos = alloc_block();
+    if (pos == -1) { io_batch_end(); return; }
 
     Group g;
     g.gid = sb.next_gid++;
     strcpy(g.groupname, groupname);
     g.next = sb.first_group;
 
-    fseek(disk, pos, SEEK_SET);
-    fwrite(&g, sizeof(Group), 1, disk);
+    io_write(&g, sizeof(Group), BLOCK_OFF(pos));
 
     sb.first_group = pos;
     fs_save_superblock();
+    io_batch_end();
     printf("Group added.\n");
 }
 
 void fs_groupdel(const char *groupname) {
     if (current_uid != 0) { printf("Permission denied.\n"); return; }
     // ... (Traversal similar to userdel) ...
-    int32_t prev = -1;
-    int32_t curr = sb.first_group;
+    int64_t prev = -1;
+    int64_t curr = sb.first_group;
     while(curr != -1) {
         Group g;
-        fseek(disk, curr, SEEK_SET);
-        fread(&g, sizeof(Group), 1, disk);
+        io_read(&g, sizeof(Group), BLOCK_OFF(curr));
         if (strcmp(g.groupname, groupname) == 0) {
             if (prev == -1) sb.first_group = g.next;
             else {
                 Group p;
-                fseek(disk, prev, SEEK_SET);
-                fread(&p, sizeof(Group), 1, disk);
+                io_read(&p, sizeof(Group), BLOCK_OFF(prev));
                 p.next = g.next;
-                fseek(disk, prev, SEEK_SET);
-                fwrite(&p, sizeof(Group), 1, disk);
+                io_write(&p, sizeof(Group), BLOCK_OFF(prev));
             }
             free_block(curr);
             fs_save_superblock();
@@ -333,7 +1070,7 @@ void fs_groupdel(const char *groupname) {
 void fs_usermod(const char *username, const char *groupname) {
     if (current_uid != 0) { printf("Permission denied.\n"); return; }
     User u;
-    int32_t u_pos = find_user_by_name(username, &u);
+    int64_t u_pos = find_user_by_name(username, &u);
     if (u_pos == -1) { printf("User not found.\n"); return; }
     Group g;
     if (find_group_by_name(groupname, &g) == -1) { printf("Group not found.\n"); return; }
@@ -341,43 +1078,80 @@ void fs_usermod(const char *username, const char *groupname) {
     for(int i=0; i<MAX_USER_GROUPS; i++) {
         if(u.gids[i] == -1) {
             u.gids[i] = g.gid;
-            fseek(disk, u_pos, SEEK_SET);
-            fwrite(&u, sizeof(User), 1, disk);
+            io_write(&u, sizeof(User), BLOCK_OFF(u_pos));
             printf("User added to group.\n");
             return;
         }
     }
 }
 
-void fs_login(const char *username) {
+int fs_login(const char *username) {
     User u;
     if (find_user_by_name(username, &u) != -1) {
         current_uid = u.uid;
         reload_current_user_groups();
         printf("Logged in as %s.\n", username);
         fs_close();
-    } else printf("User not found.\n");
+        return 0;
+    }
+    printf("User not found.\n");
+    return -1;
 }
 
 int32_t fs_get_current_uid() { return current_uid; }
 
+// --- SESSIONS ---
+
+void fs_session_init(FsSession *s) {
+    memset(s, 0, sizeof(FsSession));
+    s->file_pos = -1;
+    s->rm_epoch = rm_epoch;
+    memset(s->groups, -1, sizeof(s->groups));
+    s->groups[0] = 0;
+}
+
+void fs_session_save(FsSession *s) {
+    s->file = current_file;
+    s->file_pos = current_file_pos;
+    s->rm_epoch = rm_epoch;
+    s->uid = current_uid;
+    s->gid = current_gid;
+    memcpy(s->groups, current_user_groups, sizeof(current_user_groups));
+}
+
+// Other sessions may have written or removed the open file in the meantime,
+// so its entry is re-read rather than trusted
+void fs_session_load(const FsSession *s) {
+    current_file_pos = s->file_pos;
+    current_uid = s->uid;
+    current_gid = s->gid;
+    memcpy(current_user_groups, s->groups, sizeof(current_user_groups));
+    if (current_file_pos == -1) return;
+    if (s->rm_epoch != rm_epoch && fs_find_file(s->file.name) != current_file_pos) {
+        current_file_pos = -1;
+        return;
+    }
+    io_read(&current_file, sizeof(FileEntry), BLOCK_OFF(current_file_pos));
+}
+
 // --- FILE OPERATIONS ---
 
 int fs_open(const char *name, int flags) {
-    int32_t pos = fs_find_file(name);
+    int64_t pos = fs_find_file(name);
 
     if (pos != -1) {
-        fseek(disk, pos, SEEK_SET);
-        fread(&current_file, sizeof(FileEntry), 1, disk);
+        io_read(&current_file, sizeof(FileEntry), BLOCK_OFF(pos));
         if (!fs_check_permission(&current_file, R_OK)) return -1;
         current_file_pos = pos;
         return 0;
     }
 
-    if (!(flags & 1)) return -1;
+    if (!(flags & FS_O_CREAT)) return -1;
 
-    int32_t fe_pos = alloc_block(); // Always allocates a full block
-    if (fe_pos == -1) return -1;
+    // Bitmap, entry and superblock updates go out as one batch
+    io_batch_begin();
+    int64_t fe_pos = alloc_block(); // Always allocates a full block
+    if (fe_pos == -1) { io_batch_end(); return -1; }
 
     FileEntry fe;
     memset(&fe, 0, sizeof(fe));
@@ -388,13 +1162,27 @@ int fs_open(const char *name, int flags) {
     fe.gid = current_gid;
     fe.data_block = -1;
     fe.next = sb.first_file;
+    fe.flags = (flags & FS_O_COMPRESS) ? FE_COMPRESS : 0;
+    fe.stored_size = 0;
 
-    fseek(disk, fe_pos, SEEK_SET);
-    fwrite(&fe, sizeof(FileEntry), 1, disk);
+    io_write(&fe, sizeof(FileEntry), BLOCK_OFF(fe_pos));
 
     sb.first_file = fe_pos;
     sb.file_count++;
     fs_save_superblock();
+    io_batch_end();
+    if (bt_insert(fe.name, fe_pos) == -1) {
+        // Unindexed files cannot be found again: undo the create (the
+        // entry is still the list head)
+        io_batch_begin();
+        sb.first_file = fe.next;
+        sb.file_count--;
+        free_block(fe_pos);
+        fs_save_superblock();
+        io_batch_end();
+        printf("Cannot create %s: no room in the name index.\n", name);
+        return -1;
+    }
 
     current_file = fe;
     current_file_pos = fe_pos;
@@ -403,31 +1191,105 @@ int fs_open(const char *name, int flags) {
 
 int fs_write(int pos, int n_bytes, const char *buffer) {
     if (current_file_pos == -1) return -1;
+    if (pos < 0 || n_bytes < 0) return -1; // The block is patched in memory
     if (!fs_check_permission(&current_file, W_OK)) return -1;
 
-    // Allocate Data Block if not exists
-    if (current_file.data_block == -1) {
-        current_file.data_block = alloc_block();
-        if (current_file.data_block == -1) return -1;
-    }
+    if (current_file.flags & FE_COMPRESS) return fs_write_compressed(pos, n_bytes, buffer);
 
     // Limit to 1 block for simplicity in this assignment version
     if (pos + n_bytes > BLOCK_SIZE) n_bytes = BLOCK_SIZE - pos;
     if (n_bytes <= 0) return 0;
 
-    fseek(disk, current_file.data_block + pos, SEEK_SET);
-    fwrite(buffer, 1, n_bytes, disk);
+    // Blocks are content addressed (and may be shared), so patch a private
+    // copy of the block and store it whole
+    uint8_t data[MAX_COMPRESSED_SIZE];
+    int len = fs_load_data(&current_file, data);
+    if (len == -1) return -1;
+    if (len > BLOCK_SIZE) len = BLOCK_SIZE;
+    memcpy(data + pos, buffer, n_bytes);
+    if (pos + n_bytes > len) len = pos + n_bytes;
+
+    io_batch_begin();
+    if (fs_store_block(&current_file, data, len) == -1) { io_batch_end(); return -1; }
 
     if (pos + n_bytes > current_file.size) current_file.size = pos + n_bytes;
 
-    fseek(disk, current_file_pos, SEEK_SET);
-    fwrite(&current_file, sizeof(FileEntry), 1, disk);
+    io_write(&current_file, sizeof(FileEntry), BLOCK_OFF(current_file_pos));
+    io_batch_end();
+
+    return n_bytes;
+}
+
+// Unpacks the logical content of fe into buf (MAX_COMPRESSED_SIZE bytes).
+// Bytes past fe->size are zeroed. Returns the logical size or -1.
+int fs_load_data(FileEntry *fe, uint8_t *buf) {
+    memset(buf, 0, MAX_COMPRESSED_SIZE);
+    if (fe->data_block == -1) return 0;
+
+    int size = fe->size < MAX_COMPRESSED_SIZE ? fe->size : MAX_COMPRESSED_SIZE;
+    if (fe->flags & FE_PACKED) {
+        uint8_t packed[BLOCK_SIZE];
+        io_read(packed, fe->stored_size, BLOCK_OFF(fe->data_block));
+        int n = lz_decompress(packed, fe->stored_size, buf, MAX_COMPRESSED_SIZE);
+        if (n == -1) {
+            printf("Corrupt compressed block in %s.\n", fe->name);
+            return -1;
+        }
+        if (n > size) memset(buf + size, 0, n - size);
+    } else {
+        int raw = size < fe->stored_size ? size : fe->stored_size;
+        io_read(buf, raw, BLOCK_OFF(fe->data_block));
+    }
+    return size;
+}
+
+// Read-modify-write of the whole file: unpack, patch, repack.
+// Falls back to raw storage (capped at one block) when LZ does not help.
+int fs_write_compressed(int pos, int n_bytes, const char *buffer) {
+    uint8_t data[MAX_COMPRESSED_SIZE];
+    uint8_t packed[BLOCK_SIZE];
+
+    if (pos + n_bytes > MAX_COMPRESSED_SIZE) n_bytes = MAX_COMPRESSED_SIZE - pos;
+    if (n_bytes <= 0) return 0;
+
+    int size = fs_load_data(&current_file, data);
+    if (size == -1) return -1;
+    int old_size = size;
+    memcpy(data + pos, buffer, n_bytes);
+    if (pos + n_bytes > size) size = pos + n_bytes;
+
+    int plen = lz_compress(data, size, packed, BLOCK_SIZE);
+    int packs = plen != -1 && plen < size;
+    if (!packs && size > BLOCK_SIZE) {
+        // The raw fallback holds one block: the write may come up short,
+        // but content that is already stored must not be cut off
+        if (old_size > BLOCK_SIZE) {
+            printf("Write to %s failed: content no longer compresses into one block.\n", current_file.name);
+            return -1;
+        }
+        if (pos >= BLOCK_SIZE) return 0;
+        if (pos + n_bytes > BLOCK_SIZE) n_bytes = BLOCK_SIZE - pos;
+        size = BLOCK_SIZE;
+    }
+
+    io_batch_begin();
+    if (fs_store_block(&current_file, packs ? packed : data, packs ? plen : size) == -1) {
+        io_batch_end();
+        return -1;
+    }
+    if (packs) current_file.flags |= FE_PACKED;
+    else current_file.flags &= ~FE_PACKED;
+    current_file.size = size;
+
+    io_write(&current_file, sizeof(FileEntry), BLOCK_OFF(current_file_pos));
+    io_batch_end();
 
     return n_bytes;
 }
 
 int fs_read(int pos, int n_bytes, char *buffer) {
     if (current_file_pos == -1) return -1;
+    if (pos < 0 || n_bytes < 0) return -1;
     if (!fs_check_permission(&current_file, R_OK)) return -1;
     if (current_file.data_block == -1) return 0;
     if (pos >= current_file.size) return 0;
@@ -435,35 +1297,48 @@ int fs_read(int pos, int n_bytes, char *buffer) {
     int available = current_file.size - pos;
     if (n_bytes > available) n_bytes = available;
 
-    fseek(disk, current_file.data_block + pos, SEEK_SET);
-    fread(buffer, 1, n_bytes, disk);
+    if (current_file.flags & FE_PACKED) {
+        // A packed stream never unpacks past MAX_COMPRESSED_SIZE
+        if (pos >= MAX_COMPRESSED_SIZE) return 0;
+        if (n_bytes > MAX_COMPRESSED_SIZE - pos) n_bytes = MAX_COMPRESSED_SIZE - pos;
+        uint8_t data[MAX_COMPRESSED_SIZE];
+        if (fs_load_data(&current_file, data) == -1) return -1;
+        memcpy(buffer, data + pos, n_bytes);
+    } else {
+        // Bytes past the stored extent read back as zeros
+        int stored = current_file.stored_size - pos;
+        if (stored < 0) stored = 0;
+        if (stored > n_bytes) stored = n_bytes;
+        io_read(buffer, stored, BLOCK_OFF(current_file.data_block) + pos);
+        memset(buffer + stored, 0, n_bytes - stored);
+    }
     buffer[n_bytes] = '\0';
     return n_bytes;
 }
 
-void fs_rm(const char *name) {
-    int32_t prev_pos = -1;
-    int32_t curr_pos = sb.first_file;
+int fs_rm(const char *name) {
+    FileEntry prev; // Must outlive the batch below
+    int64_t prev_pos = -1;
+    int64_t curr_pos = sb.first_file;
 
     while (curr_pos != -1) {
         FileEntry fe;
-        fseek(disk, curr_pos, SEEK_SET);
-        fread(&fe, sizeof(FileEntry), 1, disk);
+        io_read(&fe, sizeof(FileEntry), BLOCK_OFF(curr_pos));
 
         if (strcmp(fe.name, name) == 0) {
             if (current_uid != 0 && current_uid != fe.uid) {
                 printf("Permission denied.\n");
-                return;
+                return -1;
             }
 
+            if (prev_pos != -1) io_read(&prev, sizeof(FileEntry), BLOCK_OFF(prev_pos));
+
+            // Unlink, bitmap and superblock updates go out as one batch
+            io_batch_begin();
             if (prev_pos == -1) sb.first_file = fe.next;
             else {
-                FileEntry prev;
-                fseek(disk, prev_pos, SEEK_SET);
-                fread(&prev, sizeof(FileEntry), 1, disk);
                 prev.next = fe.next;
-                fseek(disk, prev_pos, SEEK_SET);
-                fwrite(&prev, sizeof(FileEntry), 1, disk);
+                io_write(&prev, sizeof(FileEntry), BLOCK_OFF(prev_pos));
             }
 
             if (fe.data_block != -1) free_block(fe.data_block);
@@ -471,32 +1346,46 @@ void fs_rm(const char *name) {
 
             sb.file_count--;
             fs_save_superblock();
+            io_batch_end();
+            bt_delete(fe.name);
+            rm_epoch++;
             if (current_file_pos == curr_pos) current_file_pos = -1;
             // printf("File deleted.\n"); // Silenced for stress test
-            return;
+            return 0;
         }
         prev_pos = curr_pos;
         curr_pos = fe.next;
     }
+    return -1;
 }
 
-void fs_shrink(int new_size) {
-    if (current_file_pos == -1) return;
-    if (!fs_check_permission(&current_file, W_OK)) return; 
+int fs_shrink(int new_size) {
+    if (current_file_pos == -1) return -1;
+    if (!fs_check_permission(&current_file, W_OK)) return -1; 
     if (new_size < 0) new_size = 0;
+    // Compressed files are unpacked into a MAX_COMPRESSED_SIZE buffer, even
+    // while they are stored raw
+    if ((current_file.flags & FE_COMPRESS) && new_size > MAX_COMPRESSED_SIZE) {
+        printf("Compressed files are limited to %d bytes.\n", MAX_COMPRESSED_SIZE);
+        return -1;
+    }
     // For simplicity, just update size, we don't partial free blocks here
     current_file.size = new_size;
-    fseek(disk, current_file_pos, SEEK_SET);
-    fwrite(&current_file, sizeof(FileEntry), 1, disk);
+    // A packed stream is left as is; reads stop at the new logical size
+    if (!(current_file.flags & FE_PACKED)) {
+        if (new_size < current_file.stored_size) current_file.stored_size = new_size;
+    }
+    io_write(&current_file, sizeof(FileEntry), BLOCK_OFF(current_file_pos));
+    return 0;
 }
 
 // ... (chmod, chown, chgrp, getfacl, stats, print_users kept roughly same)
 void fs_chmod(const char *path, int mode) { /* Same logic as before */ 
-    int32_t pos = fs_find_file(path);
+    int64_t pos = fs_find_file(path);
     if(pos==-1)return;
-    FileEntry fe; fseek(disk, pos, SEEK_SET); fread(&fe, sizeof(fe), 1, disk);
+    FileEntry fe; io_read(&fe, sizeof(fe), BLOCK_OFF(pos));
     if(current_uid!=0 && current_uid!=fe.uid) return;
-    fe.permission=mode; fseek(disk, pos, SEEK_SET); fwrite(&fe, sizeof(fe), 1, disk);
+    fe.permission=mode; io_write(&fe, sizeof(fe), BLOCK_OFF(pos));
 }
 void fs_chown(const char *path, const char *ou, const char *og) { /* Logic same */ }
 void fs_chgrp(const char *path, const char *g) { /* Logic same */ }
@@ -507,26 +1396,663 @@ void fs_close() { current_file_pos = -1; }
 void fs_stats() {
     printf("--- FS Stats ---\n");
     printf("Block Size: %d\n", BLOCK_SIZE);
-    printf("Total Blocks: %d\n", TOTAL_BLOCKS);
+    printf("Total Blocks: %lld (%lld bytes)\n", (long long)sb.total_blocks, (long long)BLOCK_OFF(sb.total_blocks));
+    printf("Bitmap: %lld blocks at block %lld\n", (long long)sb.bitmap_blocks, (long long)sb.bitmap_start);
     printf("File Count: %d\n", sb.file_count);
     
-    int free_blocks = 0;
-    for(int i=0; i<BLOCK_SIZE; i++) {
-        for(int b=0; b<8; b++) {
-            if (!((bitmap[i] >> b) & 1)) free_blocks++;
+    int64_t free_blocks = 0;
+    for (int64_t b = 0; b < sb.total_blocks; b++) {
+        if (!((bitmap[b / 8] >> (b % 8)) & 1)) free_blocks++;
+    }
+    printf("Free Blocks: %lld\n", (long long)free_blocks);
+
+    // Size accounting: logical bytes vs bytes actually stored in data blocks
+    int64_t logical = 0, physical = 0;
+    int compressed_files = 0;
+    int64_t pos = sb.first_file;
+    while (pos != -1) {
+        FileEntry fe;
+        io_read(&fe, sizeof(FileEntry), BLOCK_OFF(pos));
+        if (fe.data_block != -1) logical += fe.size;
+        if (fe.flags & FE_PACKED) compressed_files++;
+        pos = fe.next;
+    }
+    // A shared block is stored once, however many files point at it
+    for (int64_t i = 0; i < dedup_slots; i++) {
+        if (dedup_blocks[i].addr != -1) physical += dedup_blocks[i].len;
+    }
+    printf("Logical Size: %lld bytes\n", (long long)logical);
+    printf("Physical Size: %lld bytes\n", (long long)physical);
+    printf("Compressed Files: %d\n", compressed_files);
+    if (physical > 0) printf("Compression Ratio: %.2f\n", (double)logical / physical);
+
+    // Deduplication: every extra reference to a data block is a block saved
+    int64_t shared_blocks = 0;
+    int64_t saved_blocks = 0;
+    for (int64_t i = 0; i < dedup_slots; i++) {
+        if (dedup_blocks[i].addr != -1 && dedup_blocks[i].refs > 1) {
+            shared_blocks++;
+            saved_blocks += dedup_blocks[i].refs - 1;
+        }
+    }
+    printf("Dedup Hits: %lld / %lld stores", (long long)dedup_hits, (long long)dedup_lookups);
+    if (dedup_lookups > 0) printf(" (%.1f%%)", 100.0 * dedup_hits / dedup_lookups);
+    printf("\n");
+    printf("Shared Blocks: %lld\n", (long long)shared_blocks);
+    printf("Space Saved: %lld blocks (%lld bytes)\n", (long long)saved_blocks, (long long)saved_blocks * BLOCK_SIZE);
+    printf("Dedup Index: %lld blocks in %lld slots (%lld KB)\n", (long long)dedup_count, (long long)dedup_slots,
+           (long long)(dedup_slots * (sizeof(DedupEntry) + sizeof(DedupLink)) / 1024));
+    io_print_stats();
+}
+
+// --- GEOMETRY ---
+// The image grows online: new blocks are appended and marked free. When the
+// bitmap needs more blocks than it has, it moves to the front of the added
+// space. The superblock write is the commit point: until it lands, the old
+// superblock still describes the old image and the old bitmap intact.
+
+int fs_grow(int64_t new_total) {
+    if (current_uid != 0) { printf("Permission denied.\n"); return -1; }
+    int64_t old_total = sb.total_blocks;
+    if (new_total <= old_total) {
+        printf("New size must exceed the current %lld blocks.\n", (long long)old_total);
+        return -1;
+    }
+
+    int64_t old_start = sb.bitmap_start;
+    int64_t old_blocks = sb.bitmap_blocks;
+    int64_t new_blocks = (new_total + BITS_PER_BITMAP_BLOCK - 1) / BITS_PER_BITMAP_BLOCK;
+    int relocate = new_blocks > old_blocks;
+    if (relocate && new_total - old_total < new_blocks) {
+        printf("Grow by at least %lld blocks to make room for the larger bitmap.\n", (long long)new_blocks);
+        return -1;
+    }
+
+    // Memory first: nothing on disk changes if the larger bitmap does not fit
+    uint8_t *grown = relocate ? realloc(bitmap, new_blocks * BLOCK_SIZE) : bitmap;
+    if (!grown) {
+        printf("Not enough memory to grow to %lld blocks.\n", (long long)new_total);
+        return -1;
+    }
+    bitmap = grown;
+
+    // Extend the image; the old superblock ignores the tail. Queued stdio
+    // writes are flushed first so the size check sees the real file.
+    struct stat st;
+    int fd = io_fd();
+    if (fstat(fd, &st) == -1 ||
+        (st.st_size < BLOCK_OFF(new_total) && ftruncate(fd, BLOCK_OFF(new_total)) == -1)) {
+        perror("Failed to extend the image");
+        return -1;
+    }
+
+    // Bits past the old end were never set, so the new blocks start free
+    if (relocate) {
+        memset(bitmap + old_blocks * BLOCK_SIZE, 0, (new_blocks - old_blocks) * BLOCK_SIZE);
+        for (int64_t b = old_total; b < old_total + new_blocks; b++) {
+            bitmap[b / 8] |= (1 << (b % 8));
+        }
+        sb.bitmap_start = old_total;
+        sb.bitmap_blocks = new_blocks;
+    }
+    sb.total_blocks = new_total;
+
+    fs_save_bitmap();
+    io_sync();
+    fs_save_superblock(); // Commit point
+
+    if (relocate) {
+        // Release the old bitmap region
+        for (int64_t b = old_start; b < old_start + old_blocks; b++) {
+            bitmap[b / 8] &= ~(1 << (b % 8));
+        }
+        io_batch_begin();
+        for (int64_t b = old_start; b < old_start + old_blocks; b++) fs_save_bitmap_block(b);
+        io_batch_end();
+    }
+
+    printf("Grew filesystem from %lld to %lld blocks", (long long)old_total, (long long)new_total);
+    if (relocate) printf(" (bitmap moved to block %lld, %lld blocks)", (long long)sb.bitmap_start, (long long)sb.bitmap_blocks);
+    printf(".\n");
+    return 0;
+}
+
+// --- CONSISTENCY CHECK (FSCK) ---
+// Phase 1 walks the file, user and group lists concurrently (one thread
+// each), recording every chain; the chains are then claimed in owner[] in a
+// fixed order (files, users, groups), so cross-linked lists are always cut
+// the same way. The name index is checked against the file list on the main
+// thread (it is derived data, so it never wins a block over the lists and is
+// rebuilt rather than patched when it disagrees). File entries the list lost
+// behind a broken link but the index still reaches are salvaged, together
+// with the entries they link to, and relinked at the end of the list. Phase 2 splits the file
+// entries across threads to claim and validate data blocks. Phase 3 splits
+// the image into block ranges and reconciles owner[] with the bitmap.
+// Workers only read (pread on the shared fd); repairs that touch the disk are
+// applied serially afterwards.
+
+#define FSCK_MAX_THREADS 8
+
+// OWN_STALE marks the nodes of a broken index: freed for the rebuild, but
+// not reported as leaks
+enum { OWN_NONE, OWN_RESERVED, OWN_FILE, OWN_USER, OWN_GROUP, OWN_DATA, OWN_INDEX, OWN_STALE };
+
+typedef struct {
+    int kind;                // OWN_FILE / OWN_USER / OWN_GROUP
+    int64_t head;
+    size_t entry_size;
+    size_t next_offset;
+    int64_t cut_prev;        // Entry whose next link is broken (-1 = list head)
+    int cut;
+    int32_t count;
+    int64_t *addrs;          // Entry blocks in list order
+    FileEntry *files;        // Collected for phase 2 (file list only)
+    int32_t cap;
+    int oom;                 // Ran out of memory collecting entries
+} FsckWalk;
+
+typedef struct {
+    int32_t *file_idx;       // Block -> index into fsck_files, -1 if none
+    uint8_t *seen;           // Per file: already referenced by a leaf
+    int64_t *nodes;          // Claimed nodes, released again if broken
+    int64_t node_count;
+    int64_t prev_leaf_next;  // next link of the previous leaf (-2 = none yet)
+    int32_t entries;
+    int broken;
+} FsckIndex;
+
+typedef struct {
+    const char *name;
+    int32_t file;            // Index into fsck_files
+} FsckName;
+
+typedef struct {
+    int64_t lo, hi;
+    int64_t bad_links, leaked, unmarked, double_alloc, corrupt, ref_mismatch;
+} FsckRange;
+
+int fsck_fd;
+int fsck_repair;
+uint8_t *fsck_owner;
+uint8_t *fsck_seen;          // Phase 1: bit (1 << kind) per list that reached the block
+uint32_t *fsck_refs;
+uint8_t *fsck_detach;
+FsckWalk fsck_files;
+
+int fsck_valid_addr(int64_t addr) {
+    // Block 0 and the bitmap region never hold entries or data
+    return addr >= 1 && addr < sb.total_blocks &&
+           !(addr >= sb.bitmap_start && addr < sb.bitmap_start + sb.bitmap_blocks);
+}
+
+int fsck_claim(int64_t addr, uint8_t kind) {
+    uint8_t expected = OWN_NONE;
+    return __atomic_compare_exchange_n(&fsck_owner[addr], &expected, kind,
+                                       0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+// Returns -1 (and sets w->oom) if the entry does not fit in memory
+int fsck_walk_add(FsckWalk *w, int64_t pos, const void *entry) {
+    if (w->count == w->cap) {
+        int32_t cap = w->cap ? w->cap * 2 : 1024;
+        int64_t *addrs = realloc(w->addrs, cap * sizeof(int64_t));
+        if (addrs) w->addrs = addrs;
+        FileEntry *files = w->kind == OWN_FILE ? realloc(w->files, cap * sizeof(FileEntry)) : NULL;
+        if (files) w->files = files;
+        if (!addrs || (w->kind == OWN_FILE && !files)) {
+            w->oom = 1;
+            return -1;
+        }
+        w->cap = cap;
+    }
+    if (w->kind == OWN_FILE) memcpy(&w->files[w->count], entry, sizeof(FileEntry));
+    w->addrs[w->count++] = pos;
+    return 0;
+}
+
+void *fsck_walk_list(void *arg) {
+    FsckWalk *w = arg;
+    uint8_t entry[BLOCK_SIZE];
+    uint8_t bit = (uint8_t)(1 << w->kind);
+    int64_t prev = -1;
+    int64_t pos = w->head;
+
+    while (pos != -1) {
+        // Out of range, unreadable, or a cycle. Blocks shared with another
+        // list are settled afterwards by fsck_settle_list
+        if (!fsck_valid_addr(pos) || (__atomic_fetch_or(&fsck_seen[pos], bit, __ATOMIC_RELAXED) & bit) ||
+            pread(fsck_fd, entry, w->entry_size, BLOCK_OFF(pos)) != (ssize_t)w->entry_size) {
+            w->cut = 1;
+            w->cut_prev = prev;
+            break;
         }
+        if (fsck_walk_add(w, pos, entry) == -1) break;
+        prev = pos;
+        memcpy(&pos, entry + w->next_offset, sizeof(int64_t));
     }
-    printf("Free Blocks: %d\n", free_blocks);
+    return NULL;
+}
+
+// Serial, in a fixed list order: a list that runs into a block an earlier
+// list already owns is cut just before it
+void fsck_settle_list(FsckWalk *w) {
+    for (int32_t i = 0; i < w->count; i++) {
+        if (fsck_owner[w->addrs[i]] != OWN_NONE) {
+            w->cut = 1;
+            w->cut_prev = i > 0 ? w->addrs[i - 1] : -1;
+            w->count = i;
+            return;
+        }
+        fsck_owner[w->addrs[i]] = (uint8_t)w->kind;
+    }
+}
+
+// Takes a file entry the list does not reach when its block is in use,
+// unclaimed and holds a well-formed entry (named key, when the index points
+// at it). Salvaged entries are appended to fsck_files.
+int fsck_salvage(int64_t addr, const char *key) {
+    FileEntry fe;
+    if (!fsck_valid_addr(addr) || fsck_owner[addr] != OWN_NONE || !((bitmap[addr / 8] >> (addr % 8)) & 1) ||
+        pread(fsck_fd, &fe, sizeof(FileEntry), BLOCK_OFF(addr)) != sizeof(FileEntry) ||
+        fe.name[0] == '\0' || !memchr(fe.name, '\0', MAX_FILENAME) || (key && bt_cmp(fe.name, key) != 0)) {
+        return 0;
+    }
+    if (fsck_walk_add(&fsck_files, addr, &fe) == -1) return 0;
+    fsck_owner[addr] = OWN_FILE;
+    return 1;
+}
+
+int fsck_name_cmp(const void *a, const void *b) {
+    const FsckName *x = a, *y = b;
+    int c = bt_cmp(x->name, y->name);
+    return c ? c : (x->file > y->file) - (x->file < y->file);
+}
+
+// Drops salvaged entries (index >= listed) whose name is already taken by a
+// listed file or an earlier salvaged one; their blocks are freed as leaks.
+// Returns how many salvaged entries remain (-1 if out of memory) and sets
+// *dropped_indexed when a dropped one was still referenced by the index.
+int32_t fsck_drop_duplicates(int32_t listed, int *dropped_indexed, int32_t indexed) {
+    int32_t n = fsck_files.count;
+    if (n == listed) return 0;
+    FsckName *names = malloc(n * sizeof(FsckName));
+    uint8_t *drop = calloc(n, sizeof(uint8_t));
+    if (!names || !drop) {
+        free(names);
+        free(drop);
+        return -1;
+    }
+    for (int32_t i = 0; i < n; i++) {
+        names[i].name = fsck_files.files[i].name;
+        names[i].file = i;
+    }
+    qsort(names, n, sizeof(FsckName), fsck_name_cmp);
+    for (int32_t i = 1; i < n; i++) {
+        if (names[i].file >= listed && bt_cmp(names[i - 1].name, names[i].name) == 0) drop[names[i].file] = 1;
+    }
+
+    int32_t kept = listed;
+    for (int32_t i = listed; i < n; i++) {
+        if (drop[i]) {
+            fsck_owner[fsck_files.addrs[i]] = OWN_NONE;
+            if (i < indexed) *dropped_indexed = 1;
+            continue;
+        }
+        fsck_files.files[kept] = fsck_files.files[i];
+        fsck_files.addrs[kept++] = fsck_files.addrs[i];
+    }
+    fsck_files.count = kept;
+    free(names);
+    free(drop);
+    return kept - listed;
+}
+
+// Depth-first walk; every key must lie in [lo, hi) set by the parent, leaves
+// must be chained left to right and map each listed file exactly once. A
+// broken tree is still walked as far as its links are sound, so all of its
+// nodes are collected for release.
+void fsck_walk_index(int64_t addr, int depth, const char *lo, const char *hi, FsckIndex *ix) {
+    if (!fsck_valid_addr(addr) || depth == BT_MAX_DEPTH || !fsck_claim(addr, OWN_INDEX)) {
+        ix->broken = 1;
+        return;
+    }
+    ix->nodes[ix->node_count++] = addr;
+
+    BTreeNode node;
+    if (pread(fsck_fd, &node, sizeof(BTreeNode), BLOCK_OFF(addr)) != sizeof(BTreeNode) ||
+        node.nkeys < 0 || node.nkeys > BT_MAX_KEYS) {
+        ix->broken = 1;
+        return;
+    }
+    for (int i = 0; i < node.nkeys; i++) {
+        if ((lo && bt_cmp(node.keys[i], lo) < 0) || (hi && bt_cmp(node.keys[i], hi) >= 0) ||
+            (i > 0 && bt_cmp(node.keys[i - 1], node.keys[i]) >= 0)) {
+            ix->broken = 1;
+        }
+    }
+
+    if (node.is_leaf) {
+        if (ix->prev_leaf_next != -2 && ix->prev_leaf_next != addr) ix->broken = 1;
+        ix->prev_leaf_next = node.next;
+        for (int i = 0; i < node.nkeys; i++) {
+            int64_t val = node.vals[i];
+            int32_t f = fsck_valid_addr(val) ? ix->file_idx[val] : -1;
+            if (f == -1) {
+                if (!fsck_salvage(val, node.keys[i])) ix->broken = 1;
+            } else if (ix->seen[f] || bt_cmp(fsck_files.files[f].name, node.keys[i]) != 0) {
+                ix->broken = 1;
+            } else {
+                ix->seen[f] = 1;
+                ix->entries++;
+            }
+        }
+        return;
+    }
+    for (int i = 0; i <= node.nkeys; i++) {
+        fsck_walk_index(node.vals[i], depth + 1, i == 0 ? lo : node.keys[i - 1],
+                        i == node.nkeys ? hi : node.keys[i], ix);
+    }
+}
+
+void *fsck_check_data(void *arg) {
+    FsckRange *r = arg;
+    uint8_t packed[BLOCK_SIZE];
+    uint8_t data[MAX_COMPRESSED_SIZE];
+
+    for (int64_t i = r->lo; i < r->hi; i++) {
+        FileEntry *fe = &fsck_files.files[i];
+        if (fe->data_block == -1) continue;
+
+        int corrupt = !fsck_valid_addr(fe->data_block) || fe->stored_size < 0 || fe->stored_size > BLOCK_SIZE;
+        if (!corrupt && (fe->flags & FE_PACKED)) {
+            corrupt = pread(fsck_fd, packed, fe->stored_size, BLOCK_OFF(fe->data_block)) != fe->stored_size ||
+                      lz_decompress(packed, fe->stored_size, data, MAX_COMPRESSED_SIZE) == -1;
+        }
+        if (corrupt) {
+            // Left unclaimed, so the block is freed unless a sound file shares it
+            r->corrupt++;
+            fsck_detach[i] = 1;
+            continue;
+        }
+        // Data blocks may be shared between files, but never with metadata
+        if (!fsck_claim(fe->data_block, OWN_DATA) &&
+            __atomic_load_n(&fsck_owner[fe->data_block], __ATOMIC_ACQUIRE) != OWN_DATA) {
+            r->double_alloc++;
+            fsck_detach[i] = 1;
+            continue;
+        }
+        __atomic_fetch_add(&fsck_refs[fe->data_block], 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+void *fsck_check_bitmap(void *arg) {
+    FsckRange *r = arg;
+    // Ranges are multiples of 8 blocks, so each thread owns whole bitmap bytes
+    for (int64_t blk = r->lo; blk < r->hi; blk++) {
+        int used = (bitmap[blk / 8] >> (blk % 8)) & 1;
+        int owned = fsck_owner[blk] != OWN_NONE;
+        if (fsck_owner[blk] == OWN_STALE) {
+            if (fsck_repair) bitmap[blk / 8] &= ~(1 << (blk % 8));
+        } else if (used && !owned) {
+            r->leaked++;
+            if (fsck_repair) bitmap[blk / 8] &= ~(1 << (blk % 8));
+        } else if (!used && owned) {
+            r->unmarked++;
+            if (fsck_repair) bitmap[blk / 8] |= (1 << (blk % 8));
+        }
+        // Only blocks in use or referenced can have a dedup entry
+        if ((used || fsck_refs[blk]) && fsck_refs[blk] != dedup_refs(blk)) r->ref_mismatch++;
+    }
+    return NULL;
+}
+
+// Splits [0, n) into per-thread ranges rounded to `align` and runs fn on each
+void fsck_run_parallel(void *(*fn)(void *), int64_t n, int align, int threads, FsckRange *ranges) {
+    pthread_t tids[FSCK_MAX_THREADS];
+    int64_t chunk = (n + threads - 1) / threads;
+    chunk = (chunk + align - 1) / align * align;
+    for (int t = 0; t < threads; t++) {
+        memset(&ranges[t], 0, sizeof(FsckRange));
+        ranges[t].lo = t * chunk < n ? t * chunk : n;
+        ranges[t].hi = (t + 1) * chunk < n ? (t + 1) * chunk : n;
+        pthread_create(&tids[t], NULL, fn, &ranges[t]);
+    }
+    for (int t = 0; t < threads; t++) pthread_join(tids[t], NULL);
+}
+
+void fsck_cut_list(FsckWalk *w, int64_t *head) {
+    if (w->cut_prev == -1) {
+        *head = -1;
+        return;
+    }
+    uint8_t entry[BLOCK_SIZE];
+    int64_t end = -1;
+    io_read(entry, w->entry_size, BLOCK_OFF(w->cut_prev));
+    memcpy(entry + w->next_offset, &end, sizeof(int64_t));
+    io_write(entry, w->entry_size, BLOCK_OFF(w->cut_prev));
+}
+
+void fsck_free(FsckIndex *ix, FsckWalk *users, FsckWalk *groups) {
+    free(fsck_owner);
+    free(fsck_seen);
+    free(fsck_refs);
+    free(fsck_detach);
+    free(fsck_files.files);
+    free(fsck_files.addrs);
+    free(users->addrs);
+    free(groups->addrs);
+    free(ix->file_idx);
+    free(ix->seen);
+    free(ix->nodes);
+    fsck_owner = fsck_seen = fsck_detach = NULL;
+    fsck_refs = NULL;
+}
+
+// Nothing has been written when the check runs out of memory
+int fsck_out_of_memory(FsckIndex *ix, FsckWalk *users, FsckWalk *groups) {
+    printf("Not enough memory to check %lld blocks.\n", (long long)sb.total_blocks);
+    fsck_free(ix, users, groups);
+    return -1;
+}
+
+// Returns the number of problems found (and repaired when repair != 0),
+// or -1 if the check does not fit in memory
+int fs_fsck(int repair) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    FsckWalk users, groups;
+    FsckIndex ix;
+    memset(&fsck_files, 0, sizeof(FsckWalk));
+    memset(&users, 0, sizeof(FsckWalk));
+    memset(&groups, 0, sizeof(FsckWalk));
+    memset(&ix, 0, sizeof(ix));
+    fsck_fd = io_fd();
+    fsck_repair = repair;
+    fsck_owner = calloc(sb.total_blocks, sizeof(uint8_t));
+    fsck_seen = calloc(sb.total_blocks, sizeof(uint8_t));
+    fsck_refs = calloc(sb.total_blocks, sizeof(uint32_t));
+    fsck_detach = NULL;
+    ix.file_idx = malloc(sb.total_blocks * sizeof(int32_t));
+    ix.nodes = malloc(sb.total_blocks * sizeof(int64_t));
+    if (!fsck_owner || !fsck_seen || !fsck_refs || !ix.file_idx || !ix.nodes) {
+        return fsck_out_of_memory(&ix, &users, &groups);
+    }
+    fsck_owner[0] = OWN_RESERVED; // SuperBlock
+    for (int64_t i = 0; i < sb.bitmap_blocks; i++) fsck_owner[sb.bitmap_start + i] = OWN_RESERVED;
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = ncpu < 1 ? 1 : (ncpu > FSCK_MAX_THREADS ? FSCK_MAX_THREADS : (int)ncpu);
+
+    // Phase 1: metadata lists
+    fsck_files.kind = OWN_FILE;
+    fsck_files.head = sb.first_file;
+    fsck_files.entry_size = sizeof(FileEntry);
+    fsck_files.next_offset = offsetof(FileEntry, next);
+    users.kind = OWN_USER;
+    users.head = sb.first_user;
+    users.entry_size = sizeof(User);
+    users.next_offset = offsetof(User, next);
+    groups.kind = OWN_GROUP;
+    groups.head = sb.first_group;
+    groups.entry_size = sizeof(Group);
+    groups.next_offset = offsetof(Group, next);
+
+    FsckWalk *walks[3] = { &fsck_files, &users, &groups };
+    pthread_t tids[3];
+    for (int i = 0; i < 3; i++) pthread_create(&tids[i], NULL, fsck_walk_list, walks[i]);
+    for (int i = 0; i < 3; i++) pthread_join(tids[i], NULL);
+    if (fsck_files.oom || users.oom || groups.oom) return fsck_out_of_memory(&ix, &users, &groups);
+    for (int i = 0; i < 3; i++) fsck_settle_list(walks[i]);
+    free(fsck_seen);
+    fsck_seen = NULL;
+
+    // Phase 1b: name index
+    ix.seen = calloc(fsck_files.count + 1, sizeof(uint8_t));
+    if (!ix.seen) return fsck_out_of_memory(&ix, &users, &groups);
+    ix.prev_leaf_next = -2;
+    memset(ix.file_idx, -1, sb.total_blocks * sizeof(int32_t));
+    for (int i = 0; i < fsck_files.count; i++) ix.file_idx[fsck_files.addrs[i]] = i;
+    int32_t listed = fsck_files.count;
+    fsck_walk_index(sb.btree_root, 0, NULL, NULL, &ix);
+
+    // Salvage: the index found entries listed..indexed-1; follow their links
+    // to the rest of the lost tail. Those are not in the index, so keeping
+    // any of them means a rebuild, as does dropping an indexed one.
+    int32_t indexed = fsck_files.count;
+    for (int32_t i = listed; i < fsck_files.count; i++) fsck_salvage(fsck_files.files[i].next, NULL);
+    int dropped_indexed = 0;
+    int32_t salvaged = fsck_drop_duplicates(listed, &dropped_indexed, indexed);
+    if (fsck_files.oom || salvaged == -1) return fsck_out_of_memory(&ix, &users, &groups);
+    if (ix.prev_leaf_next != -1 || ix.entries != listed || dropped_indexed ||
+        fsck_files.count > indexed) {
+        ix.broken = 1;
+    }
+    if (ix.broken) {
+        // Release its blocks so a file's data may still claim one in phase 2
+        for (int64_t i = 0; i < ix.node_count; i++) {
+            if (fsck_owner[ix.nodes[i]] == OWN_INDEX) fsck_owner[ix.nodes[i]] = OWN_NONE;
+        }
+    }
+
+    // Phase 2: data blocks
+    FsckRange ranges[FSCK_MAX_THREADS];
+    fsck_detach = calloc(fsck_files.count + 1, sizeof(uint8_t));
+    if (!fsck_detach) return fsck_out_of_memory(&ix, &users, &groups);
+    fsck_run_parallel(fsck_check_data, fsck_files.count, 1, threads, ranges);
+    int64_t corrupt = 0, double_alloc = 0;
+    for (int t = 0; t < threads; t++) {
+        corrupt += ranges[t].corrupt;
+        double_alloc += ranges[t].double_alloc;
+    }
+    if (ix.broken) {
+        // Whatever data did not take is freed in phase 3 before the rebuild
+        for (int64_t i = 0; i < ix.node_count; i++) {
+            if (fsck_owner[ix.nodes[i]] == OWN_NONE) fsck_owner[ix.nodes[i]] = OWN_STALE;
+        }
+    }
+
+    // Phase 3: bitmap and reference counts
+    fsck_run_parallel(fsck_check_bitmap, sb.total_blocks, 8, threads, ranges);
+    int64_t leaked = 0, unmarked = 0, ref_mismatch = 0;
+    for (int t = 0; t < threads; t++) {
+        leaked += ranges[t].leaked;
+        unmarked += ranges[t].unmarked;
+        ref_mismatch += ranges[t].ref_mismatch;
+    }
+
+    int bad_links = fsck_files.cut + users.cut + groups.cut;
+    int32_t sb_file_count = sb.file_count;
+    int bad_count = sb_file_count != fsck_files.count;
+    int problems = bad_links + (int)(corrupt + double_alloc + leaked + unmarked + ref_mismatch) +
+                   bad_count + ix.broken + salvaged;
+
+    if (repair && problems > 0) {
+        if (users.cut) fsck_cut_list(&users, &sb.first_user);
+        if (groups.cut) fsck_cut_list(&groups, &sb.first_group);
+        // The file list is relinked in the snapshot: from its last kept
+        // entry on, every entry points at the next (salvaged) one, so the
+        // detach writes below carry the new links too
+        int32_t relink = fsck_files.count;
+        if (fsck_files.cut || salvaged > 0) {
+            relink = listed > 0 ? listed - 1 : 0;
+            if (listed == 0) sb.first_file = fsck_files.count > 0 ? fsck_files.addrs[0] : -1;
+            for (int32_t i = relink; i < fsck_files.count; i++) {
+                fsck_files.files[i].next = i + 1 < fsck_files.count ? fsck_files.addrs[i + 1] : -1;
+            }
+        }
+        io_batch_begin();
+        for (int i = 0; i < fsck_files.count; i++) {
+            if (!fsck_detach[i] && i < relink) continue;
+            FileEntry *fe = &fsck_files.files[i];
+            if (fsck_detach[i]) {
+                fe->data_block = -1;
+                fe->size = 0;
+                fe->stored_size = 0;
+                fe->flags &= ~FE_PACKED;
+            }
+            io_write(fe, sizeof(FileEntry), BLOCK_OFF(fsck_files.addrs[i]));
+        }
+        sb.file_count = fsck_files.count;
+        fs_save_bitmap();
+        fs_save_superblock();
+        io_batch_end();
+        dedup_rebuild();
+        if (ix.broken) bt_rebuild();
+        fs_close();
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    printf("--- FSCK ---\n");
+    printf("Files: %d, Users: %d, Groups: %d\n", fsck_files.count, users.count, groups.count);
+    printf("Broken Links: %d\n", bad_links);
+    printf("Double Allocations: %lld\n", (long long)double_alloc);
+    printf("Corrupt Data Blocks: %lld\n", (long long)corrupt);
+    printf("Leaked Blocks: %lld\n", (long long)leaked);
+    printf("Unmarked Blocks: %lld\n", (long long)unmarked);
+    printf("Refcount Mismatches: %lld\n", (long long)ref_mismatch);
+    printf("Name Index: %lld nodes, %s\n", (long long)ix.node_count,
+           ix.broken ? (repair ? "inconsistent, rebuilt" : "inconsistent") : "ok");
+    if (salvaged) printf("Salvaged Files: %d (%s)\n", salvaged, repair ? "relinked" : "relinked on repair");
+    if (bad_count) printf("File Count: superblock says %d, found %d\n", sb_file_count, fsck_files.count);
+    if (sb_file_count > fsck_files.count) {
+        printf("Lost Files: %d (%s)\n", sb_file_count - fsck_files.count, repair ? "dropped" : "dropped on repair");
+    }
+    printf("Threads: %d, Time: %.3f seconds\n", threads, elapsed);
+    if (problems == 0) printf("Filesystem clean.\n");
+    else printf("%d problem(s) %s.\n", problems, repair ? "repaired" : "found");
+
+    fsck_free(&ix, &users, &groups);
+    return problems;
 }
 
 // --- STRESS TEST ---
 
-void fs_stress_test() {
-    printf("Starting Stress Test (10000 files, 1M ops)...\n");
+void fs_io_bench() { io_bench("filesys.db", BLOCK_SIZE); }
+
+void fs_stress_test(int open_flags, int payload_size) {
+    printf("Starting Stress Test (10000 files, 1M ops%s", (open_flags & FS_O_COMPRESS) ? ", compressed" : "");
+    if (payload_size > 0) printf(", %d-byte text payload", payload_size);
+    printf(")...\n");
     printf("This might take a while. Progress bar provided.\n");
 
+    // Repetitive text, so packed files actually shrink. Each write stamps
+    // the op number at the front to keep contents distinct for dedup.
+    static const char pattern[] = "stress test payload: repeated log text compresses well. ";
+    char word[] = "stress";
+    char *payload = word;
+    int payload_len = 6;
+    if (payload_size > 0) {
+        payload = malloc(payload_size);
+        for (int i = 0; i < payload_size; i++) payload[i] = pattern[i % (sizeof(pattern) - 1)];
+        payload_len = payload_size;
+    }
+
     // Reset Disk for fair test
-    if (disk) fclose(disk);
+    io_close();
     remove("filesys.db");
     fs_open_disk();
 
@@ -537,7 +2063,7 @@ void fs_stress_test() {
     char name[32];
     for (int i = 0; i < 10000; i++) {
         sprintf(name, "f%d", i);
-        fs_open(name, 1);
+        fs_open(name, FS_O_CREAT | open_flags);
         if (i % 500 == 0) { printf("."); fflush(stdout); }
     }
     printf("\nDone.\n");
@@ -554,7 +2080,7 @@ void fs_stress_test() {
 
         if (fs_open(name, 0) == -1) {
             // If deleted, recreate
-            fs_open(name, 1);
+            fs_open(name, FS_O_CREAT | open_flags);
             continue;
         }
 
@@ -562,7 +2088,12 @@ void fs_stress_test() {
             char buf[16];
             fs_read(0, 10, buf);
         } else if (op == 1) { // Write
-            fs_write(0, 6, "stress");
+            if (payload_size > 0) {
+                char stamp[16];
+                snprintf(stamp, sizeof(stamp), "%08d", i);
+                memcpy(payload, stamp, payload_len < 8 ? payload_len : 8);
+            }
+            fs_write(0, payload_len, payload);
         } else if (op == 2) { // Resize
             fs_shrink(rand() % 100);
         } else if (op == 3) { // Delete & Recreate logic
@@ -573,9 +2104,11 @@ void fs_stress_test() {
     }
     
     clock_t end = clock();
+    if (payload_size > 0) free(payload);
     double cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
     
     printf("\nTest Completed.\n");
-    printf("Time elapsed: %.2f seconds\n", cpu_time_used);
+    printf("Time elapsed: %.2f seconds (%s backend)\n", cpu_time_used, io_backend_name(io_backend()));
+    if (cpu_time_used > 0) printf("Throughput: %.0f ops/sec\n", 1000000 / cpu_time_used);
     fs_stats();
 }
@@ -10,42 +10,67 @@
 #define MAX_USERNAME 32
 #define MAX_GROUPNAME 32
 #define MAX_USER_GROUPS 8 
+#define FS_VERSION 6
 
 // New Configurations based on assignment
+// Block count and bitmap placement are recorded in the SuperBlock at format
+// time (and changed by fs_grow); BLOCK_SIZE is checked against it at mount.
 #define BLOCK_SIZE 4096
-#define TOTAL_BLOCKS 32768
-#define DISK_SIZE (TOTAL_BLOCKS * BLOCK_SIZE) // ~128 MB
+#define DEFAULT_TOTAL_BLOCKS 32768 // ~128 MB
+#define BITS_PER_BITMAP_BLOCK (BLOCK_SIZE * 8)
+#define BLOCK_OFF(b) ((int64_t)(b) * BLOCK_SIZE) // Block number -> byte offset
+
+// Compressed files may hold more than one block of logical data,
+// as long as the packed stream still fits in their single data block
+#define MAX_COMPRESSED_SIZE (4 * BLOCK_SIZE)
+#define STRESS_TEXT_SIZE (2 * BLOCK_SIZE) // "stressTest z" payload: only fits packed
 
 // Permission Macros
 #define R_OK 4
 #define W_OK 2
 #define X_OK 1
 
+// fs_open Flags
+#define FS_O_CREAT 1
+#define FS_O_COMPRESS 2 // Only honoured when the file is created
+
+// FileEntry Flags
+#define FE_COMPRESS 1 // File was created with compression enabled
+#define FE_PACKED 2   // Data block currently holds an LZ stream
+
 // User Structure
 typedef struct {
     int32_t uid;
     char username[MAX_USERNAME];
     int32_t gids[MAX_USER_GROUPS];
-    int32_t next; 
+    int64_t next; 
 } User;
 
 // Group Structure
 typedef struct {
     int32_t gid;
     char groupname[MAX_GROUPNAME];
-    int32_t next;
+    int64_t next;
 } Group;
 
 // SuperBlock
+// All block references on disk are 64-bit block numbers (-1 = none)
 typedef struct {
     int32_t magic;
     int32_t version;
-    // first_free_block REMOVED (Replaced by Bitmap in Block 1)
+    int32_t block_size;
+    // first_free_block REMOVED (Replaced by the Bitmap region)
     int32_t file_count;
-    int32_t first_file;
 
-    int32_t first_user;
-    int32_t first_group;
+    // Geometry
+    int64_t total_blocks;
+    int64_t bitmap_start;  // First block of the bitmap region
+    int64_t bitmap_blocks; // Moves to the end of the image when a grow outgrows it
+
+    int64_t first_file;
+    int64_t first_user;
+    int64_t first_group;
+    int64_t btree_root; // Name index (B+tree) root node
     int32_t next_uid;
     int32_t next_gid;
 } SuperBlock;
@@ -57,22 +82,80 @@ typedef struct {
     int32_t permission;
     int32_t uid;
     int32_t gid;
-    int32_t data_block;
-    int32_t next;
+    int64_t data_block;
+    int64_t next;
+    int32_t flags;
+    int32_t stored_size; // Physical bytes in data_block (packed or raw)
 } FileEntry;
 
+// B+tree Node (one block)
+// Keys are file names. Leaves map each key to its FileEntry address and are
+// chained through next for range scans; internal nodes hold nkeys + 1
+// children, child i covering keys in [keys[i-1], keys[i]). Both arrays have
+// one spare slot so a node can overflow in memory before it is split.
+#define BT_MAX_KEYS ((BLOCK_SIZE - 16 - MAX_FILENAME - 2 * 8) / (MAX_FILENAME + 8))
+#define BT_MAX_DEPTH 8
+typedef struct {
+    int32_t is_leaf;
+    int32_t nkeys;
+    int64_t next; // Leaf: right sibling, -1 at the end
+    char keys[BT_MAX_KEYS + 1][MAX_FILENAME];
+    int64_t vals[BT_MAX_KEYS + 2]; // Leaf: FileEntry blocks; internal: children
+} BTreeNode;
+
+#define LS_PAGE_SIZE 64
+
+// Client Session (daemon mode)
+// The fs_* calls act on one set of globals (open file, user, groups); the
+// daemon keeps one session per connection and swaps it in before serving
+// that connection's requests.
+typedef struct {
+    FileEntry file;
+    int64_t file_pos; // -1 = no open file
+    int64_t rm_epoch; // Removals seen when the session was saved
+    int32_t uid;
+    int32_t gid;
+    int32_t groups[MAX_USER_GROUPS];
+} FsSession;
+
+// Deduplication Index (in memory only)
+// Every data block in use has a DedupEntry, found by address, and a
+// DedupLink, found by fingerprint. Both tables use linear probing with
+// addr == -1 marking an empty slot; they start at DEDUP_MIN_SLOTS and
+// double as blocks are stored, so the load factor stays <= 0.5.
+#define DEDUP_MIN_SLOTS 1024
+
+typedef struct {
+    int64_t addr;
+    uint64_t fp;
+    int32_t len;   // Bytes stored in the block
+    uint32_t refs; // FileEntries sharing the block
+} DedupEntry;
+
+typedef struct {
+    uint64_t fp;
+    int64_t addr;
+} DedupLink;
+
 // --- FUNCTION DECLARATIONS ---
 
+void fs_set_io_backend(int backend); // IO_STDIO or IO_URING, before fs_open_disk
+void fs_set_format_blocks(int64_t blocks); // Image size used if fs_open_disk formats
 void fs_open_disk();
 void fs_save_superblock();
 
 // Core File Operations
-int32_t fs_find_file(const char *filename);
+int64_t fs_find_file(const char *filename);
 int fs_open(const char *name, int flags);
 int fs_read(int pos, int n_bytes, char *buffer);
 int fs_write(int pos, int n_bytes, const char *buffer);
-void fs_rm(const char *name);
-void fs_shrink(int new_size);
+int fs_rm(const char *name);
+int fs_shrink(int new_size);
+
+// Sorted Listing (B+tree range scans)
+int fs_list(const char *prefix, const char *after, int limit, char names[][MAX_FILENAME],
+            int64_t *addrs); // addrs (optional) receives each FileEntry block
+void fs_ls(const char *prefix);
 
 // User & Group Management
 void fs_useradd(const char *username);
@@ -80,7 +163,7 @@ void fs_userdel(const char *username);
 void fs_groupadd(const char *groupname);
 void fs_groupdel(const char *groupname);
 void fs_usermod(const char *username, const char *groupname);
-void fs_login(const char *username);
+int fs_login(const char *username);
 int32_t fs_get_current_uid();
 void fs_print_users();
 
@@ -92,7 +175,19 @@ void fs_getfacl(const char *path);
 
 // System
 void fs_close();
+void fs_session_init(FsSession *s); // Root, no open file (like a new shell)
+void fs_session_save(FsSession *s);
+void fs_session_load(const FsSession *s);
 void fs_stats();
-void fs_stress_test(); // New function
+int fs_grow(int64_t new_total_blocks); // Online grow, root only
+int fs_fsck(int repair); // Parallel consistency check, returns problems found
+void fs_io_bench(); // stdio vs io_uring block read throughput on the image
+// open_flags is OR'd into every create; payload_size 0 writes the 6-byte
+// "stress", otherwise a compressible text payload of that many bytes
+void fs_stress_test(int open_flags, int payload_size);
+
+// LZ Codec (self-contained, used for FE_COMPRESS files)
+int lz_compress(const uint8_t *src, int n, uint8_t *dst, int cap);
+int lz_decompress(const uint8_t *src, int n, uint8_t *dst, int cap);
 
 #endif
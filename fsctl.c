@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "client.h"
+
+// One-shot client for the daemon: each run is one connection (one session)
+void usage(const char *prog) {
+    printf("Usage: %s <socket> [-u user] <command> [args]\n", prog);
+    printf("  ls [prefix]             list files in name order\n");
+    printf("  cat <name>              print a file\n");
+    printf("  put <name> <text> [c]   replace a file's content (c = compressed if created)\n");
+    printf("  truncate <name> <size>  shrink a file\n");
+    printf("  rm <name>               remove a file\n");
+}
+
+int open_file(int fd, const char *name, int flags) {
+    int status = fsd_call(fd, FSD_OP_OPEN, flags, 0, name, strlen(name), NULL, 0, NULL);
+    if (status < 0) printf("Cannot open %s.\n", name);
+    return status;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) { usage(argv[0]); return 1; }
+    int fd = fsd_connect(argv[1]);
+    if (fd < 0) { perror("connect"); return 1; }
+
+    int arg = 2;
+    if (strcmp(argv[arg], "-u") == 0) {
+        if (argc < 5) { usage(argv[0]); return 1; }
+        if (fsd_call(fd, FSD_OP_LOGIN, 0, 0, argv[3], strlen(argv[3]), NULL, 0, NULL) < 0) {
+            printf("Login failed.\n");
+            return 1;
+        }
+        arg = 4;
+    }
+    const char *cmd = argv[arg++];
+    int nargs = argc - arg;
+    char **args = argv + arg;
+    int status = -1;
+
+    if (strcmp(cmd, "ls") == 0) {
+        // Page through the index; each request resumes after the last name
+        const char *prefix = nargs > 0 ? args[0] : "";
+        char req[2 * MAX_FILENAME];
+        char names[LS_PAGE_SIZE][MAX_FILENAME];
+        char last[MAX_FILENAME] = "";
+        int total = 0;
+        while (1) {
+            size_t plen = strlen(prefix), llen = strlen(last);
+            memcpy(req, prefix, plen);
+            req[plen] = '\0';
+            memcpy(req + plen + 1, last, llen);
+            int n = fsd_call(fd, FSD_OP_LIST, LS_PAGE_SIZE, 0, req, plen + 1 + llen,
+                             names, sizeof(names), NULL);
+            if (n <= 0) { status = n; break; }
+            for (int i = 0; i < n; i++) printf("%s\n", names[i]);
+            total += n;
+            memcpy(last, names[n - 1], MAX_FILENAME);
+            if (n < LS_PAGE_SIZE) break;
+        }
+        if (status != FSD_DISCONNECTED) status = total;
+    }
+    else if (strcmp(cmd, "cat") == 0 && nargs == 1) {
+        static char data[FSD_MAX_PAYLOAD];
+        uint32_t len = 0;
+        if (open_file(fd, args[0], 0) == 0) {
+            status = fsd_call(fd, FSD_OP_READ, 0, FSD_MAX_PAYLOAD, NULL, 0, data, sizeof(data), &len);
+            if (status >= 0) fwrite(data, 1, len, stdout);
+        }
+    }
+    else if (strcmp(cmd, "put") == 0 && (nargs == 2 || nargs == 3)) {
+        int flags = FS_O_CREAT | (nargs == 3 && strcmp(args[2], "c") == 0 ? FS_O_COMPRESS : 0);
+        if (open_file(fd, args[0], flags) == 0 &&
+            fsd_call(fd, FSD_OP_SHRINK, 0, 0, NULL, 0, NULL, 0, NULL) == 0) {
+            status = fsd_call(fd, FSD_OP_WRITE, 0, 0, args[1], strlen(args[1]), NULL, 0, NULL);
+            if (status >= 0 && status < (int)strlen(args[1])) printf("Stored %d bytes (file size limit).\n", status);
+        }
+    }
+    else if (strcmp(cmd, "truncate") == 0 && nargs == 2) {
+        if (open_file(fd, args[0], 0) == 0) {
+            status = fsd_call(fd, FSD_OP_SHRINK, atoi(args[1]), 0, NULL, 0, NULL, 0, NULL);
+        }
+    }
+    else if (strcmp(cmd, "rm") == 0 && nargs == 1) {
+        status = fsd_call(fd, FSD_OP_RM, 0, 0, args[0], strlen(args[0]), NULL, 0, NULL);
+        if (status < 0) printf("Cannot remove %s.\n", args[0]);
+    }
+    else { usage(argv[0]); close(fd); return 1; }
+
+    if (status == FSD_DISCONNECTED) printf("Connection to daemon lost.\n");
+    close(fd);
+    return status < 0 ? 1 : 0;
+}
@@ -0,0 +1,352 @@
+#define _GNU_SOURCE // accept4
+#include "fsd.h"
+#include "proto.h"
+#include "fs.h"
+#include "io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// Stop reading from a client once this much reply data is waiting to be sent
+#define FSD_OUT_LIMIT (4 * (sizeof(FsdResponse) + FSD_MAX_PAYLOAD))
+
+// Connection State
+typedef struct {
+    int fd;
+    uint32_t events;  // Interest currently registered with epoll
+    FsSession session;
+    uint8_t in[sizeof(FsdRequest) + FSD_MAX_PAYLOAD];
+    size_t in_len;
+    uint8_t *out;
+    size_t out_off, out_len, out_cap;
+} FsdConn;
+
+FsdConn *fsd_conns[FSD_MAX_CONNS];
+FsdConn *fsd_active = NULL; // Connection whose session is loaded in fs
+int fsd_epoll = -1;
+volatile sig_atomic_t fsd_stop = 0;
+
+int64_t fsd_accepted = 0;
+int64_t fsd_requests = 0;
+
+// Helper Prototypes
+void fsd_close(FsdConn *c);
+void fsd_handle(FsdConn *c, const FsdRequest *req, const uint8_t *payload);
+
+void fsd_on_signal(int sig) {
+    (void)sig;
+    fsd_stop = 1;
+}
+
+// --- SESSIONS ---
+
+// Requests from one connection usually arrive back to back, so the swap is
+// skipped while the same connection stays active
+void fsd_activate(FsdConn *c) {
+    if (fsd_active == c) return;
+    if (fsd_active) fs_session_save(&fsd_active->session);
+    fs_session_load(&c->session);
+    fsd_active = c;
+}
+
+// --- CONNECTIONS ---
+
+void fsd_accept(int lfd) {
+    while (1) {
+        int fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("accept");
+            return;
+        }
+        if (fd >= FSD_MAX_CONNS) {
+            printf("Too many connections, refusing client.\n");
+            close(fd);
+            continue;
+        }
+
+        FsdConn *c = calloc(1, sizeof(FsdConn));
+        c->fd = fd;
+        c->events = EPOLLIN;
+        fs_session_init(&c->session);
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+        if (epoll_ctl(fsd_epoll, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            perror("epoll_ctl");
+            close(fd);
+            free(c);
+            continue;
+        }
+        fsd_conns[fd] = c;
+        fsd_accepted++;
+    }
+}
+
+void fsd_close(FsdConn *c) {
+    epoll_ctl(fsd_epoll, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    fsd_conns[c->fd] = NULL;
+    if (fsd_active == c) fsd_active = NULL;
+    free(c->out);
+    free(c);
+}
+
+void fsd_out_reserve(FsdConn *c, size_t n) {
+    if (c->out_len + n <= c->out_cap) return;
+    while (c->out_cap < c->out_len + n) c->out_cap = c->out_cap ? c->out_cap * 2 : 4096;
+    c->out = realloc(c->out, c->out_cap);
+}
+
+// Returns -1 if the peer has gone away
+int fsd_flush(FsdConn *c) {
+    while (c->out_off < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        c->out_off += n;
+    }
+    c->out_off = c->out_len = 0;
+    return 0;
+}
+
+// Serves every complete request in the input buffer (pipelined requests are
+// answered in order). Returns -1 on a protocol violation.
+int fsd_process(FsdConn *c) {
+    // Drop reply bytes already sent so the buffer does not creep forward
+    if (c->out_off > 0) {
+        memmove(c->out, c->out + c->out_off, c->out_len - c->out_off);
+        c->out_len -= c->out_off;
+        c->out_off = 0;
+    }
+
+    size_t off = 0;
+    while (c->out_len - c->out_off < FSD_OUT_LIMIT) {
+        FsdRequest req;
+        if (c->in_len - off < sizeof(FsdRequest)) break;
+        memcpy(&req, c->in + off, sizeof(FsdRequest));
+        if (req.len > FSD_MAX_PAYLOAD) return -1;
+        if (c->in_len - off < sizeof(FsdRequest) + req.len) break;
+
+        fsd_handle(c, &req, c->in + off + sizeof(FsdRequest));
+        off += sizeof(FsdRequest) + req.len;
+    }
+    // Keep the partial request at the front so a full one always fits
+    if (off > 0) {
+        memmove(c->in, c->in + off, c->in_len - off);
+        c->in_len -= off;
+    }
+    return 0;
+}
+
+// Reads while there is output room, otherwise waits for the client to drain
+void fsd_update_events(FsdConn *c) {
+    uint32_t want = 0;
+    if (c->out_len - c->out_off < FSD_OUT_LIMIT) want |= EPOLLIN;
+    if (c->out_off < c->out_len) want |= EPOLLOUT;
+    if (want == c->events) return;
+    struct epoll_event ev = { .events = want, .data.fd = c->fd };
+    epoll_ctl(fsd_epoll, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = want;
+}
+
+void fsd_on_event(FsdConn *c, uint32_t events) {
+    // A full input buffer always holds a complete request, so skip the read
+    if ((events & EPOLLIN) && c->in_len < sizeof(c->in)) {
+        ssize_t n = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            fsd_close(c);
+            return;
+        }
+        if (n > 0) c->in_len += n;
+    } else if ((events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN)) {
+        fsd_close(c);
+        return;
+    }
+
+    // Serve and send; once replies drain, requests held back by the output
+    // limit can run
+    while (1) {
+        size_t pending = c->in_len, queued = c->out_len;
+        if (fsd_process(c) == -1) {
+            printf("Protocol error on connection %d, closing.\n", c->fd);
+            fsd_close(c);
+            return;
+        }
+        if (fsd_flush(c) == -1) {
+            fsd_close(c);
+            return;
+        }
+        // Stop when the socket is full or there was nothing left to serve
+        if (c->out_len > 0 || (c->in_len == pending && queued == 0)) break;
+    }
+    fsd_update_events(c);
+}
+
+// --- REQUESTS ---
+
+// Copies a payload name into buf; names must fit a FileEntry / User name
+int fsd_name(const uint8_t *payload, uint32_t len, char *buf) {
+    if (len == 0 || len >= MAX_FILENAME) return -1;
+    memcpy(buf, payload, len);
+    buf[len] = '\0';
+    return strlen(buf) == len ? 0 : -1;
+}
+
+void fsd_handle(FsdConn *c, const FsdRequest *req, const uint8_t *payload) {
+    char name[MAX_FILENAME];
+    int32_t status = -1;
+    uint32_t len = 0;
+
+    fsd_activate(c);
+    fsd_requests++;
+
+    // Reply header is filled in once the payload is known
+    fsd_out_reserve(c, sizeof(FsdResponse));
+    size_t hdr = c->out_len;
+    c->out_len += sizeof(FsdResponse);
+
+    switch (req->op) {
+    case FSD_OP_LOGIN:
+        if (fsd_name(payload, req->len, name) == 0) status = fs_login(name);
+        break;
+    case FSD_OP_OPEN:
+        if (fsd_name(payload, req->len, name) == 0) {
+            status = fs_open(name, req->arg0 & (FS_O_CREAT | FS_O_COMPRESS));
+        }
+        break;
+    case FSD_OP_CLOSE:
+        fs_close();
+        status = 0;
+        break;
+    case FSD_OP_READ:
+        if (req->arg0 >= 0 && req->arg1 >= 0) {
+            int n = req->arg1 < FSD_MAX_PAYLOAD ? req->arg1 : FSD_MAX_PAYLOAD;
+            fsd_out_reserve(c, n + 1); // fs_read NUL-terminates
+            status = fs_read(req->arg0, n, (char *)c->out + c->out_len);
+            if (status > 0) len = status;
+        }
+        break;
+    case FSD_OP_WRITE:
+        if (req->arg0 >= 0) status = fs_write(req->arg0, req->len, (const char *)payload);
+        break;
+    case FSD_OP_SHRINK:
+        status = fs_shrink(req->arg0);
+        break;
+    case FSD_OP_RM:
+        if (fsd_name(payload, req->len, name) == 0) status = fs_rm(name);
+        break;
+    case FSD_OP_LIST: {
+        // Payload: prefix, then optionally '\0' and the last name already seen
+        char prefix[MAX_FILENAME] = "", after[MAX_FILENAME] = "";
+        const uint8_t *sep = memchr(payload, '\0', req->len);
+        uint32_t plen = sep ? (uint32_t)(sep - payload) : req->len;
+        uint32_t alen = sep ? req->len - plen - 1 : 0;
+        if (plen >= MAX_FILENAME || alen >= MAX_FILENAME) break;
+        memcpy(prefix, payload, plen);
+        if (alen) memcpy(after, sep + 1, alen);
+        after[alen] = '\0';
+
+        int limit = req->arg0 < 0 ? 0 : (req->arg0 > FSD_MAX_LIST ? FSD_MAX_LIST : req->arg0);
+        fsd_out_reserve(c, (size_t)limit * MAX_FILENAME);
+        status = fs_list(prefix, after[0] ? after : NULL, limit,
+                         (char (*)[MAX_FILENAME])(c->out + c->out_len), NULL);
+        len = status * MAX_FILENAME;
+        break;
+    }
+    default:
+        break;
+    }
+
+    FsdResponse resp = { len, status };
+    memcpy(c->out + hdr, &resp, sizeof(FsdResponse));
+    c->out_len += len;
+}
+
+// --- EVENT LOOP ---
+
+int fsd_serve(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Socket path too long.\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    // A socket left behind by a previous daemon is replaced
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (lfd < 0) { perror("socket"); return -1; }
+    // Sessions start as root, like the shell, so only the owner may connect.
+    // The socket is created owner-only: a chmod after bind would leave a
+    // window in which anyone could connect
+    mode_t old_mask = umask(077);
+    int bound = bind(lfd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (bound == -1) {
+        perror("bind");
+        close(lfd);
+        return -1;
+    }
+    chmod(path, 0600);
+    if (listen(lfd, SOMAXCONN) == -1) {
+        perror("listen");
+        close(lfd);
+        unlink(path);
+        return -1;
+    }
+
+    fsd_epoll = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = lfd };
+    epoll_ctl(fsd_epoll, EPOLL_CTL_ADD, lfd, &ev);
+
+    // No SA_RESTART: a signal interrupts epoll_wait so the loop can exit
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = fsd_on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Serving filesys.db on %s (%s backend). Ctrl-C to stop.\n", path, io_backend_name(io_backend()));
+    fflush(stdout);
+
+    struct epoll_event events[FSD_MAX_EVENTS];
+    while (!fsd_stop) {
+        int n = epoll_wait(fsd_epoll, events, FSD_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == lfd) fsd_accept(lfd);
+            else if (fsd_conns[fd]) fsd_on_event(fsd_conns[fd], events[i].events);
+        }
+        fflush(stdout);
+    }
+
+    for (int fd = 0; fd < FSD_MAX_CONNS; fd++) {
+        if (fsd_conns[fd]) fsd_close(fsd_conns[fd]);
+    }
+    close(lfd);
+    close(fsd_epoll);
+    unlink(path);
+    io_sync();
+    printf("Daemon stopped: %lld connections, %lld requests served.\n",
+           (long long)fsd_accepted, (long long)fsd_requests);
+    return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef FSD_H
+#define FSD_H
+
+#define FSD_MAX_CONNS 1024 // Connections served at once (indexed by fd)
+#define FSD_MAX_EVENTS 64  // epoll events handled per wakeup
+
+// --- FUNCTION DECLARATIONS ---
+
+// Serves the mounted image on a Unix socket at path until SIGINT/SIGTERM.
+// Requests are handled one at a time on a single thread, so the fs_* state
+// needs no locking; each connection carries its own FsSession.
+int fsd_serve(const char *path);
+
+#endif
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "client.h"
+
+// Load Generator
+// Runs rounds of 1, 2, 4, ... up to max connections against a daemon. Every
+// connection is a thread with one request in flight (closed loop) on its own
+// file, mixing reads and overwrites. Each round reports throughput and
+// request latency percentiles.
+
+#define LOAD_MAX_CONNS 1024
+
+typedef struct {
+    int id;
+    const char *path;
+    int read_pct;
+    int size;
+    double seconds;
+    pthread_barrier_t *start;
+    int64_t ops;
+    int64_t errors;
+    double elapsed;
+    uint32_t *lat;  // Request latencies in microseconds
+    int64_t cap;
+} LoadWorker;
+
+double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void *load_worker(void *arg) {
+    LoadWorker *w = arg;
+    char name[MAX_FILENAME];
+    char *buf = malloc(FSD_MAX_PAYLOAD);
+    unsigned seed = 12345u + w->id;
+    snprintf(name, sizeof(name), "load_%d", w->id);
+    memset(buf, 'a' + w->id % 26, w->size);
+
+    int fd = fsd_connect(w->path);
+    int ready = fd >= 0 &&
+                fsd_call(fd, FSD_OP_OPEN, FS_O_CREAT, 0, name, strlen(name), NULL, 0, NULL) == 0 &&
+                fsd_call(fd, FSD_OP_WRITE, 0, 0, buf, w->size, NULL, 0, NULL) >= 0;
+    if (!ready) w->errors++;
+    pthread_barrier_wait(w->start);
+
+    double t0 = now_sec(), end = t0 + w->seconds, t = t0;
+    while (ready && t < end) {
+        int op = (int)(rand_r(&seed) % 100) < w->read_pct ? FSD_OP_READ : FSD_OP_WRITE;
+        int status;
+        if (op == FSD_OP_READ) {
+            status = fsd_call(fd, op, 0, w->size, NULL, 0, buf, FSD_MAX_PAYLOAD, NULL);
+        } else {
+            buf[rand_r(&seed) % w->size] ^= 1;
+            status = fsd_call(fd, op, 0, 0, buf, w->size, NULL, 0, NULL);
+        }
+        double t1 = now_sec();
+        if (status < 0) {
+            w->errors++;
+            if (status == FSD_DISCONNECTED) break;
+        }
+        if (w->ops == w->cap) {
+            w->cap = w->cap ? w->cap * 2 : 65536;
+            w->lat = realloc(w->lat, w->cap * sizeof(uint32_t));
+        }
+        w->lat[w->ops++] = (uint32_t)((t1 - t) * 1e6);
+        t = t1;
+    }
+    w->elapsed = t - t0;
+
+    if (fd >= 0) {
+        fsd_call(fd, FSD_OP_RM, 0, 0, name, strlen(name), NULL, 0, NULL);
+        close(fd);
+    }
+    free(buf);
+    return NULL;
+}
+
+int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+void load_round(const char *path, int conns, double seconds, int read_pct, int size) {
+    LoadWorker *workers = calloc(conns, sizeof(LoadWorker));
+    pthread_t *tids = malloc(conns * sizeof(pthread_t));
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, conns);
+
+    for (int i = 0; i < conns; i++) {
+        workers[i].id = i;
+        workers[i].path = path;
+        workers[i].read_pct = read_pct;
+        workers[i].size = size;
+        workers[i].seconds = seconds;
+        workers[i].start = &start;
+        pthread_create(&tids[i], NULL, load_worker, &workers[i]);
+    }
+    for (int i = 0; i < conns; i++) pthread_join(tids[i], NULL);
+
+    int64_t ops = 0, errors = 0;
+    double elapsed = 0;
+    for (int i = 0; i < conns; i++) {
+        ops += workers[i].ops;
+        errors += workers[i].errors;
+        if (workers[i].elapsed > elapsed) elapsed = workers[i].elapsed;
+    }
+    uint32_t *lat = malloc((ops + 1) * sizeof(uint32_t));
+    int64_t n = 0;
+    for (int i = 0; i < conns; i++) {
+        memcpy(lat + n, workers[i].lat, workers[i].ops * sizeof(uint32_t));
+        n += workers[i].ops;
+        free(workers[i].lat);
+    }
+    qsort(lat, n, sizeof(uint32_t), cmp_u32);
+
+    if (n == 0) printf("%6d  %10s  (no requests completed, %lld errors)\n", conns, "-", (long long)errors);
+    else {
+        printf("%6d  %10.0f  %8u  %8u  %8u  %8u", conns, ops / elapsed,
+               lat[n / 2], lat[n * 99 / 100], lat[n * 999 / 1000], lat[n - 1]);
+        if (errors) printf("  (%lld errors)", (long long)errors);
+        printf("\n");
+    }
+
+    pthread_barrier_destroy(&start);
+    free(lat);
+    free(tids);
+    free(workers);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s <socket> [max_conns=64] [seconds=2] [read_pct=80] [size=256]\n", argv[0]);
+        return 1;
+    }
+    const char *path = argv[1];
+    int max_conns = argc > 2 ? atoi(argv[2]) : 64;
+    double seconds = argc > 3 ? atof(argv[3]) : 2.0;
+    int read_pct = argc > 4 ? atoi(argv[4]) : 80;
+    int size = argc > 5 ? atoi(argv[5]) : 256;
+    if (max_conns < 1 || max_conns > LOAD_MAX_CONNS || seconds <= 0 ||
+        read_pct < 0 || read_pct > 100 || size < 1 || size > BLOCK_SIZE) {
+        printf("Invalid arguments (max_conns 1..%d, size 1..%d).\n", LOAD_MAX_CONNS, BLOCK_SIZE);
+        return 1;
+    }
+
+    int fd = fsd_connect(path);
+    if (fd < 0) { perror("connect"); return 1; }
+    close(fd);
+
+    printf("Load: %d%% reads, %d%% writes of %d bytes, %.1f s per round\n",
+           read_pct, 100 - read_pct, size, seconds);
+    printf("%6s  %10s  %8s  %8s  %8s  %8s\n", "conns", "req/s", "p50 us", "p99 us", "p99.9 us", "max us");
+    for (int conns = 1; ; conns *= 2) {
+        if (conns > max_conns) conns = max_conns;
+        load_round(path, conns, seconds, read_pct, size);
+        if (conns == max_conns) break;
+    }
+    return 0;
+}
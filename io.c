@@ -0,0 +1,392 @@
+#include "io.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// io_uring Instance (raw syscalls, no liburing dependency)
+typedef struct {
+    int ring_fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+} IoRing;
+
+FILE *disk = NULL;   // IO_STDIO
+int disk_fd = -1;    // IO_URING
+int active_backend = IO_STDIO;
+IoRing ring;
+
+IoRequest io_queue[IO_QUEUE_DEPTH];
+int io_queued = 0;
+int io_batch_depth = 0;
+int io_sync_pending = 0;
+
+int64_t io_requests = 0;
+int64_t io_submits = 0;
+
+// Helper Prototypes
+int ring_init(IoRing *r, unsigned entries);
+void ring_exit(IoRing *r);
+int ring_run(IoRing *r, int fd, IoRequest *reqs, int n);
+int io_flush_queue();
+
+// --- IO_URING RING ---
+
+int ring_init(IoRing *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(IoRing));
+
+    r->ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->ring_fd < 0) return -1;
+    r->entries = p.sq_entries;
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_len > r->sq_len) r->sq_len = r->cq_len;
+        r->cq_len = r->sq_len;
+    }
+
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->ring_fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) { close(r->ring_fd); return -1; }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         r->ring_fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED) { munmap(r->sq_ptr, r->sq_len); close(r->ring_fd); return -1; }
+    }
+
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->ring_fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        if (r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_len);
+        munmap(r->sq_ptr, r->sq_len);
+        close(r->ring_fd);
+        return -1;
+    }
+
+    char *sq = r->sq_ptr, *cq = r->cq_ptr;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+void ring_exit(IoRing *r) {
+    munmap(r->sqes, r->sqes_len);
+    if (r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_len);
+    munmap(r->sq_ptr, r->sq_len);
+    close(r->ring_fd);
+}
+
+// Submits reqs in ring-sized rounds and reaps every completion of a round
+// before starting the next. Returns 0, or -1 if any request failed.
+int ring_run(IoRing *r, int fd, IoRequest *reqs, int n) {
+    int status = 0;
+    for (int done = 0; done < n; ) {
+        unsigned count = n - done < (int)r->entries ? (unsigned)(n - done) : r->entries;
+
+        unsigned tail = *r->sq_tail;
+        for (unsigned i = 0; i < count; i++) {
+            IoRequest *req = &reqs[done + i];
+            unsigned idx = tail & *r->sq_mask;
+            struct io_uring_sqe *sqe = &r->sqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = req->write ? IORING_OP_WRITE : IORING_OP_READ;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)(uintptr_t)req->buf;
+            sqe->len = (uint32_t)req->len;
+            sqe->off = (uint64_t)req->off;
+            sqe->user_data = done + i;
+            r->sq_array[idx] = idx;
+            tail++;
+        }
+        __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+        unsigned to_submit = count, reaped = 0;
+        while (reaped < count) {
+            int ret = syscall(__NR_io_uring_enter, r->ring_fd, to_submit, count - reaped,
+                              IORING_ENTER_GETEVENTS, NULL, 0);
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                printf("io_uring_enter failed: %s\n", strerror(errno));
+                return -1;
+            }
+            io_submits++;
+            to_submit -= (unsigned)ret < to_submit ? (unsigned)ret : to_submit;
+
+            unsigned head = *r->cq_head;
+            while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+                struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+                IoRequest *req = &reqs[cqe->user_data];
+                if (cqe->res < 0 || (size_t)cqe->res != req->len) {
+                    printf("I/O error at offset %lld: %s\n", (long long)req->off,
+                           cqe->res < 0 ? strerror(-cqe->res) : "short transfer");
+                    status = -1;
+                }
+                head++;
+                reaped++;
+            }
+            __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+        }
+        done += count;
+    }
+    io_requests += n;
+    return status;
+}
+
+// --- OPEN / CLOSE ---
+
+int io_open(const char *path, int create, int backend) {
+    active_backend = backend;
+    io_queued = 0;
+    io_batch_depth = 0;
+
+    if (backend == IO_URING) {
+        disk_fd = open(path, create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR, 0644);
+        if (disk_fd < 0) return -1;
+        if (ring_init(&ring, IO_RING_ENTRIES) == -1) {
+            printf("io_uring unavailable (%s), falling back to stdio.\n", strerror(errno));
+            close(disk_fd);
+            disk_fd = -1;
+            active_backend = IO_STDIO;
+        } else {
+            return 0;
+        }
+    }
+
+    disk = fopen(path, create ? "w+b" : "r+b");
+    return disk ? 0 : -1;
+}
+
+void io_close() {
+    io_flush_queue();
+    if (disk) { fclose(disk); disk = NULL; }
+    if (disk_fd != -1) {
+        ring_exit(&ring);
+        close(disk_fd);
+        disk_fd = -1;
+    }
+}
+
+int io_backend() { return active_backend; }
+
+const char *io_backend_name(int backend) {
+    return backend == IO_URING ? "io_uring" : "stdio";
+}
+
+int io_fd() {
+    io_flush_queue();
+    if (disk) fflush(disk);
+    return active_backend == IO_URING ? disk_fd : fileno(disk);
+}
+
+// --- SYNCHRONOUS I/O ---
+
+int io_read(void *buf, size_t len, int64_t off) {
+    io_flush_queue(); // Never read around a queued write
+    if (active_backend == IO_URING) {
+        IoRequest req = { 0, buf, len, off };
+        return ring_run(&ring, disk_fd, &req, 1) == 0 ? (int)len : -1;
+    }
+    io_requests++;
+    io_submits++;
+    fseek(disk, off, SEEK_SET);
+    return (int)fread(buf, 1, len, disk);
+}
+
+int io_write(const void *buf, size_t len, int64_t off) {
+    if (io_batch_depth > 0) {
+        io_queue_write(buf, len, off);
+        return (int)len;
+    }
+    if (active_backend == IO_URING) {
+        IoRequest req = { 1, (void *)buf, len, off };
+        return ring_run(&ring, disk_fd, &req, 1) == 0 ? (int)len : -1;
+    }
+    io_requests++;
+    io_submits++;
+    fseek(disk, off, SEEK_SET);
+    return (int)fwrite(buf, 1, len, disk);
+}
+
+void io_sync() {
+    // Inside a batch the flush waits for io_batch_end
+    if (io_batch_depth > 0) {
+        io_sync_pending = 1;
+        return;
+    }
+    io_flush_queue();
+    if (disk) fflush(disk);
+}
+
+// --- BATCHED I/O ---
+
+int io_flush_queue() {
+    if (io_queued == 0) return 0;
+    int n = io_queued;
+    io_queued = 0;
+
+    if (active_backend == IO_URING) return ring_run(&ring, disk_fd, io_queue, n);
+
+    int status = 0;
+    for (int i = 0; i < n; i++) {
+        IoRequest *req = &io_queue[i];
+        fseek(disk, req->off, SEEK_SET);
+        size_t done = req->write ? fwrite(req->buf, 1, req->len, disk)
+                                 : fread(req->buf, 1, req->len, disk);
+        if (done != req->len) status = -1;
+    }
+    io_requests += n;
+    io_submits += n;
+    return status;
+}
+
+void io_batch_begin() { io_batch_depth++; }
+
+void io_queue_read(void *buf, size_t len, int64_t off) {
+    if (io_queued == IO_QUEUE_DEPTH) io_flush_queue();
+    IoRequest *req = &io_queue[io_queued++];
+    req->write = 0;
+    req->buf = buf;
+    req->len = len;
+    req->off = off;
+}
+
+void io_queue_write(const void *buf, size_t len, int64_t off) {
+    // Last write to a range wins; io_uring does not order requests
+    for (int i = 0; i < io_queued; i++) {
+        if (io_queue[i].write && io_queue[i].off == off && io_queue[i].len == len) {
+            io_queue[i].buf = (void *)buf;
+            return;
+        }
+    }
+    if (io_queued == IO_QUEUE_DEPTH) io_flush_queue();
+    IoRequest *req = &io_queue[io_queued++];
+    req->write = 1;
+    req->buf = (void *)buf;
+    req->len = len;
+    req->off = off;
+}
+
+int io_batch_end() {
+    if (io_batch_depth > 0) io_batch_depth--;
+    if (io_batch_depth > 0) return 0;
+    int status = io_flush_queue();
+    if (io_sync_pending) {
+        io_sync_pending = 0;
+        if (disk) fflush(disk);
+    }
+    return status;
+}
+
+// --- STATISTICS / BENCHMARK ---
+
+void io_print_stats() {
+    printf("I/O Backend: %s\n", io_backend_name(active_backend));
+    printf("I/O Requests: %lld in %lld submissions\n", (long long)io_requests, (long long)io_submits);
+}
+
+double io_elapsed(struct timespec *t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+// Reads every block of the image in random order three ways: stdio
+// fseek+fread, one io_uring request per block, and io_uring batches.
+// Uses its own FILE* and ring, so the mounted backend is not disturbed.
+void io_bench(const char *path, size_t bs) {
+    struct stat st;
+    if (stat(path, &st) != 0) { printf("Cannot stat %s.\n", path); return; }
+    int n = (int)(st.st_size / bs);
+    if (n == 0) return;
+
+    int64_t *offs = malloc(n * sizeof(int64_t));
+    char *bufs = malloc(IO_QUEUE_DEPTH * bs);
+    IoRequest *reqs = malloc(IO_QUEUE_DEPTH * sizeof(IoRequest));
+    for (int i = 0; i < n; i++) offs[i] = (int64_t)i * bs;
+    srand(42);
+    for (int i = n - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        int64_t t = offs[i]; offs[i] = offs[j]; offs[j] = t;
+    }
+    io_sync();
+
+    printf("--- I/O Benchmark (%d random %zu-byte block reads) ---\n", n, bs);
+    struct timespec t0;
+
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int i = 0; i < n; i++) {
+            fseek(f, offs[i], SEEK_SET);
+            fread(bufs, 1, bs, f);
+        }
+        double t = io_elapsed(&t0);
+        printf("stdio:            %8.3f s  %10.0f blocks/s  %8.1f MB/s\n", t, n / t, n * bs / t / 1e6);
+        fclose(f);
+    }
+
+    IoRing r;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || ring_init(&r, IO_RING_ENTRIES) == -1) {
+        printf("io_uring unavailable (%s).\n", strerror(errno));
+    } else {
+        // ring_run counts into the global statistics; keep the mount's figures
+        int64_t saved_requests = io_requests, saved_submits = io_submits;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int i = 0; i < n; i++) {
+            IoRequest req = { 0, bufs, bs, offs[i] };
+            ring_run(&r, fd, &req, 1);
+        }
+        double t = io_elapsed(&t0);
+        printf("io_uring single:  %8.3f s  %10.0f blocks/s  %8.1f MB/s\n", t, n / t, n * bs / t / 1e6);
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int i = 0; i < n; i += IO_QUEUE_DEPTH) {
+            int count = n - i < IO_QUEUE_DEPTH ? n - i : IO_QUEUE_DEPTH;
+            for (int k = 0; k < count; k++) {
+                reqs[k].write = 0;
+                reqs[k].buf = bufs + k * bs;
+                reqs[k].len = bs;
+                reqs[k].off = offs[i + k];
+            }
+            ring_run(&r, fd, reqs, count);
+        }
+        t = io_elapsed(&t0);
+        printf("io_uring batched: %8.3f s  %10.0f blocks/s  %8.1f MB/s\n", t, n / t, n * bs / t / 1e6);
+
+        io_requests = saved_requests;
+        io_submits = saved_submits;
+        ring_exit(&r);
+    }
+    if (fd >= 0) close(fd);
+
+    free(offs);
+    free(bufs);
+    free(reqs);
+}
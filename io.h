@@ -0,0 +1,48 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// I/O Backends (chosen at mount, see fs_set_io_backend)
+#define IO_STDIO 0 // One FILE*, fseek + fread/fwrite per request
+#define IO_URING 1 // Raw fd, requests submitted and reaped through io_uring
+
+#define IO_RING_ENTRIES 64   // Submission queue size of each ring
+#define IO_QUEUE_DEPTH 256   // Requests buffered by a batch before it flushes
+
+// Batched Request
+typedef struct {
+    int write;
+    void *buf;
+    size_t len;
+    int64_t off;
+} IoRequest;
+
+// --- FUNCTION DECLARATIONS ---
+
+int io_open(const char *path, int create, int backend);
+void io_close();
+int io_backend();
+const char *io_backend_name(int backend);
+int io_fd(); // Raw descriptor for pread from worker threads
+
+// Synchronous I/O (flushes any queued requests first)
+int io_read(void *buf, size_t len, int64_t off);
+int io_write(const void *buf, size_t len, int64_t off);
+void io_sync();
+
+// Batched I/O: requests queued between begin and end are submitted together.
+// Read buffers are filled and write buffers may be reused only after
+// io_batch_end. Writes issued with io_write inside a batch are queued too,
+// and a later write to the same range replaces the earlier one.
+void io_batch_begin();
+void io_queue_read(void *buf, size_t len, int64_t off);
+void io_queue_write(const void *buf, size_t len, int64_t off);
+int io_batch_end();
+
+// Statistics
+void io_print_stats();
+void io_bench(const char *path, size_t block_size);
+
+#endif
@@ -2,9 +2,24 @@
 #include <string.h>
 #include <stdlib.h>
 #include "fs.h"
+#include "io.h"
+#include "fsd.h"
 
-int main() {
+int main(int argc, char **argv) {
+    // --io=uring mounts the image through the io_uring backend
+    // --blocks=N sets the size of a newly formatted image
+    // --daemon=PATH serves the image on a Unix socket instead of the shell
+    const char *daemon_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        long long blocks;
+        if (strcmp(argv[i], "--io=uring") == 0) fs_set_io_backend(IO_URING);
+        else if (strcmp(argv[i], "--io=stdio") == 0) fs_set_io_backend(IO_STDIO);
+        else if (sscanf(argv[i], "--blocks=%lld", &blocks) == 1 && blocks >= 64) fs_set_format_blocks(blocks);
+        else if (strncmp(argv[i], "--daemon=", 9) == 0 && argv[i][9]) daemon_path = argv[i] + 9;
+        else { printf("Usage: %s [--io=stdio|--io=uring] [--blocks=N] [--daemon=PATH]\n", argv[0]); return 1; }
+    }
     fs_open_disk();
+    if (daemon_path) return fsd_serve(daemon_path) == 0 ? 0 : 1;
 
     printf("Welcome to FileSystem. Type 'help' or commands.\n");
     printf("New Command: stressTest\n");
@@ -78,7 +93,13 @@ int main() {
         
         // --- NEW COMMAND ---
         else if (strcmp(cmd, "stressTest") == 0) {
-            fs_stress_test();
+            char mode[8];
+            // "stressTest c" runs the same workload on compressed files,
+            // "stressTest z" on compressed files with a payload that packs
+            int have_mode = sscanf(line, "%*s %7s", mode) == 1;
+            if (have_mode && strcmp(mode, "c") == 0) fs_stress_test(FS_O_COMPRESS, 0);
+            else if (have_mode && strcmp(mode, "z") == 0) fs_stress_test(FS_O_COMPRESS, STRESS_TEXT_SIZE);
+            else fs_stress_test(0, 0);
         }
         // -------------------
 
@@ -86,7 +107,7 @@ int main() {
             char name[32];
             int flag;
             if(sscanf(line, "%*s %s %d", name, &flag) == 2) fs_open(name, flag);
-            else printf("Usage: open <name> <flag 1=create>\n");
+            else printf("Usage: open <name> <flag 1=create, 3=create compressed>\n");
         }
         else if (strcmp(cmd, "write") == 0) {
              int pos;
@@ -110,11 +131,28 @@ int main() {
                 if (r >= 0) printf("Read: [%s]\n", buf);
             }
         }
+        else if (strcmp(cmd, "ls") == 0) {
+            char prefix[32];
+            if (sscanf(line, "%*s %31s", prefix) == 1) fs_ls(prefix);
+            else fs_ls("");
+        }
         else if (strcmp(cmd, "rm") == 0) {
              char name[32];
              if(sscanf(line, "%*s %s", name) == 1) fs_rm(name);
         }
         else if (strcmp(cmd, "stats") == 0) fs_stats();
+        else if (strcmp(cmd, "ioBench") == 0) fs_io_bench();
+        else if (strcmp(cmd, "grow") == 0) {
+            long long blocks;
+            if (sscanf(line, "%*s %lld", &blocks) == 1) fs_grow(blocks);
+            else printf("Usage: grow <total blocks>\n");
+        }
+        else if (strcmp(cmd, "fsck") == 0) {
+            char opt[8];
+            // "fsck -n" only reports, plain "fsck" also repairs
+            if (sscanf(line, "%*s %7s", opt) == 1 && strcmp(opt, "-n") == 0) fs_fsck(0);
+            else fs_fsck(1);
+        }
         else if (strcmp(cmd, "exit") == 0) break;
         else printf("Unknown command.\n");
     }
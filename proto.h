@@ -0,0 +1,42 @@
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stdint.h>
+#include "fs.h"
+
+// Daemon Wire Protocol
+// A request is an FsdRequest header followed by len payload bytes; the reply
+// is an FsdResponse header followed by len payload bytes. Integers travel in
+// host byte order (the socket is local). Replies come back in request order,
+// so a client may pipeline several requests before reading.
+
+#define FSD_MAX_PAYLOAD MAX_COMPRESSED_SIZE // Largest file a read can return
+#define FSD_MAX_LIST (FSD_MAX_PAYLOAD / MAX_FILENAME)
+
+// Operations (status is the fs_* result, -1 on failure)
+enum {
+    FSD_OP_LOGIN = 1, // payload: user name
+    FSD_OP_OPEN,      // arg0: FS_O_* flags, payload: file name
+    FSD_OP_CLOSE,
+    FSD_OP_READ,      // arg0: pos, arg1: n_bytes; reply payload: the bytes read
+    FSD_OP_WRITE,     // arg0: pos, payload: data; status: bytes written
+    FSD_OP_SHRINK,    // arg0: new size
+    FSD_OP_RM,        // payload: file name
+    FSD_OP_LIST,      // arg0: limit, payload: prefix '\0' after
+                      // reply payload: status names of MAX_FILENAME bytes each
+};
+
+typedef struct {
+    uint32_t len;
+    uint16_t op;
+    uint16_t reserved;
+    int32_t arg0;
+    int32_t arg1;
+} FsdRequest;
+
+typedef struct {
+    uint32_t len;
+    int32_t status;
+} FsdResponse;
+
+#endif